@@ -36,7 +36,7 @@ namespace cip {
             }
 
             start = std::chrono::high_resolution_clock::now();
-            for (size_t i = 0; i < instructions_per_batch; ++i) {
+            for (size_t i = 0; i < instructions_per_batch && !this->is_idle(); ++i) {
                 this->execute(this->fetch());
                 ++instructions_executed;
             }
@@ -72,7 +72,7 @@ namespace cip {
                 }
                 batch_count++;
                 auto before_execution = std::chrono::high_resolution_clock::now();
-                for (size_t i = 0; i < instructions_per_batch; ++i) {
+                for (size_t i = 0; i < instructions_per_batch && !this->is_idle(); ++i) {
                     this->execute(this->fetch());
                     ++instructions_executed;
                 }
@@ -81,7 +81,12 @@ namespace cip {
                 const auto end = std::chrono::high_resolution_clock::now();
                 const auto execution_time = std::chrono::duration_cast<std::chrono::nanoseconds>(end - before_execution)
                     .count();
-                if (time_per_batch_ns > execution_time) {
+                if (this->is_idle()) {
+                    // Nothing to measure the batch size against, just wait out the rest of the frame
+                    if (time_per_batch_ns > execution_time) {
+                        std::this_thread::sleep_for(std::chrono::nanoseconds{ time_per_batch_ns - execution_time });
+                    }
+                } else if (time_per_batch_ns > execution_time) {
                     instructions_per_batch = static_cast<size_t>(static_cast<float>(instructions_per_batch) * 1.001f);
                 } else {
                     instructions_per_batch = static_cast<size_t>(static_cast<float>(instructions_per_batch) * 0.999f);
@@ -249,6 +249,12 @@ namespace cip {
             this->m_ip = address + this->reg(0).value();
         }
 
+        // A jump to itself can't change anything, so there's no point running it again before the next batch
+        [[nodiscard]] bool is_idle() const noexcept {
+            const auto value = static_cast<uint16_t>(this->m_memory[this->m_ip]) << 8 | this->m_memory[this->m_ip + 1];
+            return value == (0x1000 | this->m_ip);
+        }
+
         uint16_t fetch() noexcept {
             const auto value = static_cast<uint16_t>(this->m_memory[this->m_ip]) << 8 | this->m_memory[this->m_ip + 1];
             this->m_ip += 2;
@@ -1,7 +1,9 @@
 #include "host.hpp"
 
+#include <chrono>
 #include <functional>
 #include <print>
+#include <ranges>
 #include <raylib.h>
 
 namespace cip {
@@ -213,17 +215,51 @@ namespace cip {
         std::array<uint8_t, 24>{ 0x00, 0xe0, 0x12, 0x0a, 0x71, 0x0a, 0xa2, 0x17, 0x00, 0xee, 0x61, 0x02,
                                  0xa2, 0x16, 0x22, 0x04, 0x60, 0x00, 0xd0, 0x11, 0x12, 0x0a, 0xff, 0x99 };
 
+    // Roughly 700 instructions a second, about what ROMs written for the original interpreter expect
+    constexpr static int32_t InstructionsPerFrame = 12;
+    constexpr static auto FrameTime = std::chrono::microseconds{ 1'000'000 / 60 };
+    constexpr static auto CodeCacheDirectory = "jit_cache";
+    // Checked or Diagnostic when working on the JIT itself
+    constexpr static auto CoreJitProfile = jip::JitProfile::Release;
+
+    // The usual layout, the left hand side of the keyboard standing in for the COSMAC VIP's hex keypad
+    constexpr static auto KeyMap = std::array<KeyboardKey, jip::KeyCount>{
+        KEY_X, KEY_ONE, KEY_TWO, KEY_THREE, KEY_Q, KEY_W, KEY_E, KEY_A,
+        KEY_S, KEY_D, KEY_Z, KEY_C, KEY_FOUR, KEY_R, KEY_F, KEY_V,
+    };
+
     Host::Host() {
         SetTargetFPS(60);
         InitWindow(width * 10, height * 10, "Chip Core");
         this->m_core = std::make_unique<ChipCore>(*this);
         this->m_jit_core = std::make_unique<jip::JpuCore>();
 
-        std::jthread thread{ [this] {
+        std::jthread thread{ [this](const std::stop_token& stop) {
             // this->m_core->load(std::span{ cell_1d });
             // this->m_core->run();
             this->m_jit_core->core_display.clear();
+            this->m_jit_core->set_code_cache_directory(CodeCacheDirectory);
+            this->m_jit_core->set_jit_profile(CoreJitProfile);
             this->m_jit_core->load(corax);
+
+            auto next_frame = std::chrono::steady_clock::now();
+            while (!stop.stop_requested()) {
+                // Any change wakes up a guest idling on input
+                for (uint8_t key = 0; key < jip::KeyCount; key++) {
+                    this->m_jit_core->set_key(key, this->m_keys[key].load(std::memory_order_relaxed));
+                }
+
+                if (!this->m_jit_core->waiting_for_input()) {
+                    this->m_jit_core->run_for(InstructionsPerFrame);
+                }
+                this->m_jit_core->tick_timers();
+
+                next_frame += FrameTime;
+                std::this_thread::sleep_until(next_frame);
+            }
+
+            this->m_jit_core->save_code_cache();
+            this->set_finished(true);
         } };
 
         this->m_emulation_thread.swap(thread);
@@ -234,6 +270,11 @@ namespace cip {
 
     void Host::run() {
         while (!WindowShouldClose()) {
+            // Raylib only polls input on the main thread, the emulation thread picks these up once per frame
+            for (const auto& [key, host_key] : std::views::zip(this->m_keys, KeyMap)) {
+                key.store(IsKeyDown(host_key), std::memory_order_relaxed);
+            }
+
             BeginDrawing();
             ClearBackground(RAYWHITE);
 
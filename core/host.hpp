@@ -2,6 +2,8 @@
 #include "cpu/chip_core.hpp"
 #include "jpu/jpu_core.hpp"
 
+#include <array>
+#include <atomic>
 #include <thread>
 
 namespace cip {
@@ -31,6 +33,7 @@ namespace cip {
         Display m_display{};
         std::atomic_bool m_stop{ false };
         std::atomic_bool m_core_stopped{ false };
+        std::array<std::atomic_bool, jip::KeyCount> m_keys{}; // Written by the render loop, read by the emulation thread
         std::jthread m_emulation_thread{};
         std::unique_ptr<ChipCore> m_core{};
         std::unique_ptr<jip::JpuCore> m_jit_core{};
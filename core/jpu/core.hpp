@@ -9,7 +9,25 @@
 
 namespace jip {
     constexpr static uint8_t GPRegCount = 18;
-    using StackType = cip::StaticVector<uint16_t, 16, uint8_t>;
+    constexpr static uint8_t KeyCount = 16;
+    constexpr static uint8_t StackDepth = 16;
+    constexpr static size_t MemorySize = 0x2000;
+    using StackType = cip::StaticVector<uint16_t, StackDepth, uint8_t>;
+
+    // What an idle guest is waiting on, nothing it does can change until this happens
+    enum class WaitEvent : uint8_t {
+        None,
+        TimerTick,
+        Input,
+    };
+
+    // The operation VF still has to be computed from, when the JIT runs with lazy flags
+    enum class LazyFlag : uint8_t {
+        None,
+        Carry,    // a + b > 0xFF
+        NoBorrow, // a >= b
+        Bit,      // Bit b of a
+    };
 
     struct CoreState {
         CoreState() = default;
@@ -23,8 +41,50 @@ namespace jip {
         Register<uint16_t> index_register{};
         Register<uint16_t> instruction_pointer{};
         StackType stack{};
-        std::array<uint8_t, 0x2000> memory{};
+        uint8_t delay_timer{};
+        uint8_t sound_timer{};
+        std::array<bool, KeyCount> keys{};
+        // Guest instructions left before execution has to return to whoever called JitManager::execute_for
+        int32_t cycle_budget{};
+        // Set when execution gave the rest of its budget up because the guest is idle
+        WaitEvent wait_event{ WaitEvent::None };
+        // The bytes the last FX33 or FX55 wrote, and whether any of them had been compiled. Execution returns to the
+        // dispatcher right after such a write so the blocks built from those bytes can be thrown away
+        uint16_t code_write_start{};
+        uint8_t code_write_length{};
+        uint8_t code_written{};
+        // Owned by the JitManager running this state, compiled code finds both through here rather than embedding them
+        void* const* dispatch_table{ nullptr };
+        void* miss_stub{ nullptr };
+        void* resolve_flag_stub{ nullptr };
+        // The last operation whose VF nothing in its own block read, VF only holds its result once this is resolved
+        LazyFlag lazy_flag{ LazyFlag::None };
+        std::array<uint8_t, 2> lazy_flag_operands{};
+        std::array<uint8_t, MemorySize> memory{};
+        // Non zero for every byte of memory at least one compiled block was translated from
+        std::array<uint8_t, MemorySize> code_map{};
+        // Set by every compiled block as it's entered, however it was reached, and cleared by the JitManager's eviction
+        std::array<uint8_t, MemorySize> recently_used{};
         alignas(64) cip::Display core_display{};
+
+        // Computes VF if it's still pending, anything reading guest registers outside compiled code has to call this
+        void resolve_flag() noexcept {
+            const auto [a, b] = this->lazy_flag_operands;
+            switch (this->lazy_flag) {
+            case LazyFlag::None:
+                return;
+            case LazyFlag::Carry:
+                this->registers[0xF].set(static_cast<uint8_t>((a + b) >> 8));
+                break;
+            case LazyFlag::NoBorrow:
+                this->registers[0xF].set(a >= b ? 1 : 0);
+                break;
+            case LazyFlag::Bit:
+                this->registers[0xF].set(static_cast<uint8_t>((a >> b) & 1));
+                break;
+            }
+            this->lazy_flag = LazyFlag::None;
+        }
     };
 
 } // namespace jip
\ No newline at end of file
@@ -0,0 +1,212 @@
+#include "interpreter.hpp"
+#include "jit/instruction_info.hpp"
+
+#include <algorithm>
+#include <span>
+
+namespace jip {
+    constexpr static uint16_t AddressMask = MemorySize - 1;
+
+    uint16_t Interpreter::run_block(CoreState& state, uint16_t ip) noexcept {
+        // Compiled code may have left VF pending, which nothing here knows how to read
+        state.resolve_flag();
+
+        while (state.cycle_budget > 0) {
+            state.cycle_budget--;
+            if (ip + 1 >= MemorySize) {
+                break;
+            }
+
+            const auto [next_ip, ends_block] = this->step(state, ip);
+            ip = next_ip;
+
+            if (ends_block) {
+                break;
+            }
+        }
+
+        return ip;
+    }
+
+    std::pair<uint16_t, bool> Interpreter::step(CoreState& state, const uint16_t ip) noexcept {
+        auto& memory = state.memory;
+        const auto instr = static_cast<uint16_t>(memory[ip] << 8 | memory[ip + 1]);
+        const auto next_ip = static_cast<uint16_t>(ip + 2);
+
+        auto& vx = state.registers[(instr & 0xF00) >> 8];
+        const auto& vy = state.registers[(instr & 0xF0) >> 4];
+        auto& vf = state.registers[0xF];
+        const auto nn = static_cast<uint8_t>(instr & 0xFF);
+        const auto nnn = static_cast<uint16_t>(instr & 0xFFF);
+        auto& index = state.index_register;
+
+        switch (compute_type(instr)) {
+        case InstructionType::Native:
+            if (instr == 0x00E0) {
+                state.core_display = cip::Display{};
+            } else if (instr == 0x00EE) {
+                if (state.stack.empty()) {
+                    return { ip, true };
+                }
+                return { state.stack.pop(), true };
+            }
+            return { next_ip, false };
+        case InstructionType::Jump:
+            return { nnn, true };
+        case InstructionType::Call:
+            if (state.stack.size() == StackDepth) {
+                return { ip, true };
+            }
+            state.stack.push(next_ip);
+            return { nnn, true };
+        case InstructionType::SkipEqRegImm:
+            return this->skip(ip, vx.value() == nn);
+        case InstructionType::SkipNeRegImm:
+            return this->skip(ip, vx.value() != nn);
+        case InstructionType::SkipEqRegReg:
+            return this->skip(ip, vx.value() == vy.value());
+        case InstructionType::SkipNeRegReg:
+            return this->skip(ip, vx.value() != vy.value());
+        case InstructionType::LoadImm:
+            vx.set(nn);
+            break;
+        case InstructionType::AddImm:
+            vx.set(vx.value() + nn);
+            break;
+        case InstructionType::MovReg:
+            vx.set(vy.value());
+            break;
+        case InstructionType::RegOr:
+            vx.set(vx.value() | vy.value());
+            break;
+        case InstructionType::RegAnd:
+            vx.set(vx.value() & vy.value());
+            break;
+        case InstructionType::RegXor:
+            vx.set(vx.value() ^ vy.value());
+            break;
+        case InstructionType::RegAddYX: {
+            const auto sum = vx.value() + vy.value();
+            vx.set(sum);
+            vf.set(sum > 0xFF);
+            break;
+        }
+        case InstructionType::RegSubYX: {
+            const auto no_borrow = vx.value() >= vy.value();
+            vx.set(vx.value() - vy.value());
+            vf.set(no_borrow);
+            break;
+        }
+        case InstructionType::RegSubXY: {
+            const auto no_borrow = vy.value() >= vx.value();
+            vx.set(vy.value() - vx.value());
+            vf.set(no_borrow);
+            break;
+        }
+        case InstructionType::RegShrXY: {
+            const auto source = vy.value();
+            vx.set(source >> 1);
+            vf.set(source & 1);
+            break;
+        }
+        case InstructionType::RegShlXY: {
+            const auto source = vy.value();
+            vx.set(source << 1);
+            vf.set(source >> 7);
+            break;
+        }
+        case InstructionType::LoadImmI:
+            index.set(nnn);
+            break;
+        case InstructionType::LongJump:
+            return { static_cast<uint16_t>(nnn + state.registers[0].value()), true };
+        case InstructionType::Random:
+            vx.set(static_cast<uint8_t>(this->m_random()) & nn);
+            break;
+        case InstructionType::Draw: {
+            const auto start = std::min<size_t>(index.value(), MemorySize);
+            const auto rows = std::min<size_t>(instr & 0xF, MemorySize - start);
+            state.core_display.draw_sprite(vx.value(), vy.value(), std::span{ memory }.subspan(start, rows));
+            break;
+        }
+        case InstructionType::SkipKeyDown:
+            return this->skip(ip, state.keys[vx.value() & 0xF]);
+        case InstructionType::SkipKeyUp:
+            return this->skip(ip, !state.keys[vx.value() & 0xF]);
+        case InstructionType::LoadRegDelay:
+            vx.set(state.delay_timer);
+            break;
+        case InstructionType::WaitKeyPress: {
+            const auto key = std::ranges::find(state.keys, true);
+            if (key == state.keys.end()) {
+                state.wait_event = WaitEvent::Input;
+                state.cycle_budget = 0;
+                return { ip, true };
+            }
+            vx.set(static_cast<uint8_t>(key - state.keys.begin()));
+            break;
+        }
+        case InstructionType::LoadDelayReg:
+            state.delay_timer = vx.value();
+            break;
+        case InstructionType::SetSoundReg:
+            state.sound_timer = vx.value();
+            break;
+        case InstructionType::IAddReg:
+            index.set(index.value() + vx.value());
+            break;
+        case InstructionType::LoadFont:
+            index.set((vx.value() & 0xF) * 5);
+            break;
+        case InstructionType::BCD: {
+            const auto value = vx.value();
+            memory[index.value() & AddressMask] = value / 100;
+            memory[(index.value() + 1) & AddressMask] = value / 10 % 10;
+            memory[(index.value() + 2) & AddressMask] = value % 10;
+            return { next_ip, wrote_code(state, index.value(), 3) };
+        }
+        case InstructionType::RangeWrite: {
+            const auto last = (instr & 0xF00) >> 8;
+            const auto start = index.value();
+            for (int reg = 0; reg <= last; reg++) {
+                memory[(start + reg) & AddressMask] = state.registers[reg].value();
+            }
+            index.set(start + last + 1);
+            return { next_ip, wrote_code(state, start, static_cast<uint8_t>(last + 1)) };
+        }
+        case InstructionType::RangeRead: {
+            const auto last = (instr & 0xF00) >> 8;
+            for (int reg = 0; reg <= last; reg++) {
+                state.registers[reg].set(memory[(index.value() + reg) & AddressMask]);
+            }
+            index.set(index.value() + last + 1);
+            break;
+        }
+        case InstructionType::Invalid:
+            return { ip, true };
+        }
+
+        return { next_ip, false };
+    }
+
+    bool Interpreter::wrote_code(CoreState& state, const uint16_t start, const uint8_t length) noexcept {
+        state.code_write_start = start;
+        state.code_write_length = length;
+
+        for (uint16_t offset = 0; offset < length; offset++) {
+            state.code_written |= state.code_map[(start + offset) & AddressMask];
+        }
+
+        return state.code_written != 0;
+    }
+
+    std::pair<uint16_t, bool> Interpreter::skip(const uint16_t ip, const bool taken) noexcept {
+        if ((ip & 1) == 0) {
+            auto& bias = this->m_skip_bias[ip >> 1];
+            bias = static_cast<int8_t>(std::clamp(bias + (taken ? 1 : -1), -SkipBiasLimit, SkipBiasLimit));
+            this->m_skip_profile.set(ip >> 1, bias < 0);
+        }
+
+        return { static_cast<uint16_t>(ip + (taken ? 4 : 2)), false };
+    }
+} // namespace jip
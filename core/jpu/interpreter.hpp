@@ -0,0 +1,46 @@
+#pragma once
+#include "core.hpp"
+#include "jit/instruction_list.hpp"
+
+#include <array>
+#include <cstdint>
+#include <random>
+#include <utility>
+
+namespace jip {
+    // The cold tier, code runs here until the JitManager decides it has been executed often enough to compile
+    class Interpreter {
+    public:
+        Interpreter() = default;
+        ~Interpreter() = default;
+        Interpreter(const Interpreter&) = delete;
+        Interpreter& operator=(const Interpreter&) = delete;
+        Interpreter(Interpreter&&) = delete;
+        Interpreter& operator=(Interpreter&&) = delete;
+
+        // Executes from `ip` up to and including the first jump, call or return taken, and returns the ip execution
+        // continues at. Instructions which can't make progress (invalid opcodes, FX0A with no key held) end the block
+        // on themselves so the dispatcher gets to retry them. Every instruction, even one that stalls, is charged
+        // against the cycle budget, and running out ends the block early
+        uint16_t run_block(CoreState& state, uint16_t ip) noexcept;
+
+        // Which skips have mostly fallen through to the instruction they guard so far
+        [[nodiscard]] const SkipProfile& skip_profile() const noexcept { return this->m_skip_profile; }
+
+    private:
+        // Returns the next ip, and whether the instruction ended the block
+        std::pair<uint16_t, bool> step(CoreState& state, uint16_t ip) noexcept;
+        std::pair<uint16_t, bool> skip(uint16_t ip, bool taken) noexcept;
+
+        // Records a memory write the same way compiled code does, true if it hit compiled code and the block has to
+        // end so the dispatcher can invalidate it
+        static bool wrote_code(CoreState& state, uint16_t start, uint8_t length) noexcept;
+
+    private:
+        constexpr static int SkipBiasLimit = 8;
+
+        std::minstd_rand m_random{ std::random_device{}() };
+        std::array<int8_t, MemorySize / 2> m_skip_bias{}; // Saturating count of taken minus not taken per skip
+        SkipProfile m_skip_profile{};
+    };
+} // namespace jip
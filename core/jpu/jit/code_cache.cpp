@@ -0,0 +1,264 @@
+#include "code_cache.hpp"
+
+#include <cstring>
+#include <fstream>
+#include <ranges>
+#include <system_error>
+
+#ifdef _WIN32
+#include <iterator>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace jip {
+    constexpr static size_t EntryAlignment = 8;
+
+    static void append(std::vector<uint8_t>& out, const std::span<const std::byte> bytes) {
+        const auto* data = reinterpret_cast<const uint8_t*>(bytes.data());
+        out.insert(out.end(), data, data + bytes.size());
+    }
+
+    template <typename T>
+    static bool
+    read_array(const std::span<const uint8_t> entry, size_t& offset, const size_t count, std::vector<T>& out) {
+        if (count * sizeof(T) > entry.size() - offset) {
+            return false;
+        }
+
+        out.resize(count);
+        std::memcpy(out.data(), entry.data() + offset, count * sizeof(T));
+        offset += count * sizeof(T);
+        return true;
+    }
+
+    constexpr static uint64_t FnvOffsetBasis = 0xCBF29CE484222325;
+
+    static uint64_t fnv_1a(const std::span<const uint8_t> bytes, uint64_t hash) noexcept {
+        for (const auto byte : bytes) {
+            hash ^= byte;
+            hash *= 0x100000001B3;
+        }
+
+        return hash;
+    }
+
+    CodeCache::~CodeCache() {
+        this->unmap_file();
+    }
+
+    uint64_t CodeCache::hash_rom(const std::span<const uint8_t> rom) noexcept {
+        return fnv_1a(rom, FnvOffsetBasis);
+    }
+
+    bool CodeCache::open(std::filesystem::path path, const uint64_t rom_hash) noexcept {
+        this->unmap_file();
+        this->m_path = std::move(path);
+        this->m_rom_hash = rom_hash;
+        this->m_stored_blocks.clear();
+
+        if (!this->map_file()) {
+            return false;
+        }
+
+        FileHeader header{};
+        if (this->m_mapping.size() < sizeof(header)) {
+            this->unmap_file();
+            return false;
+        }
+
+        std::memcpy(&header, this->m_mapping.data(), sizeof(header));
+        if (header.magic != Magic || header.version != CompilerVersion || header.rom_hash != rom_hash) {
+            this->unmap_file();
+            return false;
+        }
+
+        // Entries are only checked enough here to walk the file, parse_entry does the rest once one is taken
+        size_t offset = sizeof(header);
+        for (uint32_t i = 0; i < header.block_count; i++) {
+            EntryHeader entry{};
+            if (this->m_mapping.size() - offset < sizeof(entry)) {
+                break;
+            }
+
+            std::memcpy(&entry, this->m_mapping.data() + offset, sizeof(entry));
+            if (entry.entry_size < sizeof(entry) || entry.entry_size > this->m_mapping.size() - offset) {
+                break;
+            }
+
+            this->m_mapped_blocks.insert_or_assign(entry.start_ip, this->m_mapping.subspan(offset, entry.entry_size));
+            offset += entry.entry_size;
+        }
+
+        return !this->m_mapped_blocks.empty();
+    }
+
+    std::optional<CodeCache::CachedBlock> CodeCache::take(const uint16_t ip) noexcept {
+        const auto it = this->m_mapped_blocks.find(ip);
+        if (it == this->m_mapped_blocks.end()) {
+            return std::nullopt;
+        }
+
+        const auto entry = it->second;
+        this->m_mapped_blocks.erase(it);
+
+        return parse_entry(entry);
+    }
+
+    void CodeCache::store(const JitBlock& block) {
+        EntryHeader header{
+            .start_ip = block.start_ip(),
+            .exit_count = static_cast<uint16_t>(block.exits().size()),
+            .word_count = static_cast<uint16_t>(block.code().size()),
+            .code_size = static_cast<uint32_t>(block.code_size()),
+        };
+
+        std::vector<uint8_t> entry{};
+        append(entry, std::as_bytes(std::span{ &header, 1 }));
+        append(entry, std::as_bytes(std::span{ block.exits() }));
+        append(entry, std::as_bytes(std::span{ block.code() }));
+        append(entry, std::as_bytes(std::span{ static_cast<const uint8_t*>(block.entry()), block.code_size() }));
+        entry.resize((entry.size() + EntryAlignment - 1) & ~(EntryAlignment - 1));
+
+        header.entry_size = static_cast<uint32_t>(entry.size());
+        std::memcpy(entry.data(), &header, sizeof(header));
+        header.checksum = checksum(entry);
+        std::memcpy(entry.data(), &header, sizeof(header));
+
+        // Whatever the file had for this ip is stale now
+        this->m_mapped_blocks.erase(block.start_ip());
+        this->m_stored_blocks.insert_or_assign(block.start_ip(), std::move(entry));
+    }
+
+    bool CodeCache::save() noexcept {
+        if (this->m_path.empty()) {
+            return false;
+        }
+
+        const auto header = FileHeader{
+            .magic = Magic,
+            .version = CompilerVersion,
+            .block_count = static_cast<uint32_t>(this->m_mapped_blocks.size() + this->m_stored_blocks.size()),
+            .rom_hash = this->m_rom_hash,
+        };
+
+        // Written next to the old file and renamed over it, so the mapping stays valid and a crash mid write leaves
+        // the previous cache intact
+        auto temporary = this->m_path;
+        temporary += ".tmp";
+        {
+            std::ofstream file{ temporary, std::ios::binary | std::ios::trunc };
+            file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+            for (const auto& entry : this->m_mapped_blocks | std::views::values) {
+                file.write(reinterpret_cast<const char*>(entry.data()), static_cast<std::streamsize>(entry.size()));
+            }
+
+            for (const auto& entry : this->m_stored_blocks | std::views::values) {
+                file.write(reinterpret_cast<const char*>(entry.data()), static_cast<std::streamsize>(entry.size()));
+            }
+
+            if (!file) {
+                return false;
+            }
+        }
+
+        std::error_code error{};
+        std::filesystem::rename(temporary, this->m_path, error);
+        return !error;
+    }
+
+    std::optional<CodeCache::CachedBlock> CodeCache::parse_entry(const std::span<const uint8_t> entry) noexcept {
+        EntryHeader header{};
+        std::memcpy(&header, entry.data(), sizeof(header));
+
+        // Nothing else in the entry can be trusted until this matches, least of all the code
+        if (header.checksum != checksum(entry)) {
+            return std::nullopt;
+        }
+
+        CachedBlock block{ .start_ip = header.start_ip };
+        size_t offset = sizeof(header);
+
+        if (!read_array(entry, offset, header.exit_count, block.exits) ||
+            !read_array(entry, offset, header.word_count, block.words) ||
+            header.code_size > entry.size() - offset) {
+            return std::nullopt;
+        }
+
+        block.code = entry.subspan(offset, header.code_size);
+
+        // An exit outside the code would have linking patch memory the block doesn't own
+        for (const auto& exit : block.exits) {
+            if (exit.patch_offset + sizeof(int32_t) > block.code.size()) {
+                return std::nullopt;
+            }
+        }
+
+        return block;
+    }
+
+    uint64_t CodeCache::checksum(const std::span<const uint8_t> entry) noexcept {
+        constexpr auto field = offsetof(EntryHeader, checksum);
+        constexpr auto zeroes = std::array<uint8_t, sizeof(EntryHeader::checksum)>{};
+
+        auto hash = fnv_1a(entry.first(field), FnvOffsetBasis);
+        hash = fnv_1a(zeroes, hash);
+        return fnv_1a(entry.subspan(field + zeroes.size()), hash);
+    }
+
+#ifdef _WIN32
+    bool CodeCache::map_file() noexcept {
+        std::ifstream file{ this->m_path, std::ios::binary };
+        if (!file) {
+            return false;
+        }
+
+        this->m_file_contents.assign(std::istreambuf_iterator<char>{ file }, std::istreambuf_iterator<char>{});
+        this->m_mapping = this->m_file_contents;
+        return true;
+    }
+
+    void CodeCache::unmap_file() noexcept {
+        this->m_mapped_blocks.clear();
+        this->m_mapping = {};
+        this->m_file_contents.clear();
+    }
+#else
+    bool CodeCache::map_file() noexcept {
+        const auto fd = ::open(this->m_path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return false;
+        }
+
+        struct stat info{};
+        if (::fstat(fd, &info) != 0 || info.st_size == 0) {
+            ::close(fd);
+            return false;
+        }
+
+        const auto size = static_cast<size_t>(info.st_size);
+        auto* mapping = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        // The mapping keeps its own reference to the file
+        ::close(fd);
+
+        if (mapping == MAP_FAILED) {
+            return false;
+        }
+
+        this->m_mapping = std::span{ static_cast<const uint8_t*>(mapping), size };
+        return true;
+    }
+
+    void CodeCache::unmap_file() noexcept {
+        this->m_mapped_blocks.clear();
+        if (!this->m_mapping.empty()) {
+            ::munmap(const_cast<uint8_t*>(this->m_mapping.data()), this->m_mapping.size());
+        }
+        this->m_mapping = {};
+    }
+#endif
+} // namespace jip
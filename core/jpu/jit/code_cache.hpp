@@ -0,0 +1,87 @@
+#pragma once
+#include "jit_block.hpp"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <span>
+#include <unordered_map>
+#include <vector>
+
+namespace jip {
+    // Bump whenever the generated code or the cache layout changes, caches written by any other version get ignored
+    constexpr static uint32_t CompilerVersion = 19;
+
+    // Compiled blocks of one ROM as they were the last time the cache was saved, keyed by the ROM's hash, the compiler
+    // version and each block's start ip. The file is mapped read only and a block is only copied out of it once the
+    // dispatcher first reaches its ip
+    class CodeCache {
+    public:
+        struct CachedBlock {
+            uint16_t start_ip{};
+            std::span<const uint8_t> code{}; // Unlinked
+            std::vector<JitBlock::Exit> exits{};
+            std::vector<JitBlock::CodeWord> words{};
+        };
+
+        CodeCache() = default;
+        ~CodeCache();
+        CodeCache(const CodeCache&) = delete;
+        CodeCache& operator=(const CodeCache&) = delete;
+        CodeCache(CodeCache&&) = delete;
+        CodeCache& operator=(CodeCache&&) = delete;
+
+        // 64 bit FNV-1a
+        [[nodiscard]] static uint64_t hash_rom(std::span<const uint8_t> rom) noexcept;
+
+        // False if `path` holds nothing usable for this ROM and compiler version, save still writes there either way.
+        // Entries are checksummed, a damaged one is never handed out by take
+        bool open(std::filesystem::path path, uint64_t rom_hash) noexcept;
+
+        // Hands out the block cached for `ip` at most once, whatever it's turned into is stored back if it's kept
+        [[nodiscard]] std::optional<CachedBlock> take(uint16_t ip) noexcept;
+
+        // Copies the block's code out of executable memory, so it has to happen before any of its exits get linked
+        void store(const JitBlock& block);
+
+        // Rewrites the file with everything stored plus whatever was never taken, false if it couldn't be written
+        bool save() noexcept;
+
+    private:
+        struct FileHeader {
+            std::array<char, 8> magic{};
+            uint32_t version{};
+            uint32_t block_count{};
+            uint64_t rom_hash{};
+        };
+
+        // Followed by the exits, code words and code, padded so the next entry starts 8 byte aligned
+        struct EntryHeader {
+            uint16_t start_ip{};
+            uint16_t exit_count{};
+            uint16_t word_count{};
+            uint16_t padding{};
+            uint32_t code_size{};
+            uint32_t entry_size{};
+            uint64_t checksum{}; // Of the whole entry, padding included, with this field zeroed
+        };
+
+        [[nodiscard]] static std::optional<CachedBlock> parse_entry(std::span<const uint8_t> entry) noexcept;
+        [[nodiscard]] static uint64_t checksum(std::span<const uint8_t> entry) noexcept;
+
+        bool map_file() noexcept;
+        void unmap_file() noexcept;
+
+    private:
+        constexpr static std::array<char, 8> Magic{ 'C', 'H', 'I', 'P', 'Z', 'J', 'I', 'T' };
+
+        std::filesystem::path m_path{};
+        uint64_t m_rom_hash{ 0 };
+        std::span<const uint8_t> m_mapping{};
+        std::vector<uint8_t> m_file_contents{}; // Where the file gets read to on hosts without mmap
+        std::unordered_map<uint16_t, std::span<const uint8_t>> m_mapped_blocks{}; // Entries in the file not taken yet
+        std::unordered_map<uint16_t, std::vector<uint8_t>> m_stored_blocks{};     // Serialised the same way
+    };
+} // namespace jip
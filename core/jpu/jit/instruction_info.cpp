@@ -70,9 +70,9 @@ namespace jip {
             case 0x7:
                 return InstructionType::LoadRegDelay;
             case 0xA:
-                return InstructionType::LoadDelayReg;
-            case 0x15:
                 return InstructionType::WaitKeyPress;
+            case 0x15:
+                return InstructionType::LoadDelayReg;
             case 0x18:
                 return InstructionType::SetSoundReg;
             case 0x1E:
@@ -1,5 +1,8 @@
 #include "instruction_list.hpp"
 
+#include "ir/ir_manager.hpp"
+
+#include <algorithm>
 #include <optional>
 #include <stdexcept>
 #include <utility>
@@ -19,7 +22,8 @@ namespace jip {
         }
     }
 
-    void InstructionList::create_block(MemoryStream stream, const uint16_t ip) {
+    void InstructionList::create_block(const std::span<const uint8_t> memory, const uint16_t ip) {
+        auto stream = MemoryStream{ memory.subspan(ip) };
         auto current_ip = ip;
 
         // Plan:
@@ -33,13 +37,17 @@ namespace jip {
         // We check if it's a jump which jumps into our own block, if so we note it and end the block (infinite loop
         // detected) if it's not a jump which jumps into our own block we also note it and end the current block
         //
+        // If the instruction is a call to a short leaf subroutine we inline its body instead
+        //
         // If the instruction is "normal" we just consume it
-        while (true) {
-            const auto instr = this->decode_instruction(stream.next_word());
-            current_ip += 2;
-            if (!instr.has_value()) {
+        //
+        // Anything the JIT can't lower ends the block in front of it, the interpreter picks up from there
+        while (stream.has_next()) {
+            const auto instr = this->decode_instruction(stream.next_word(), current_ip);
+            if (!instr.has_value() || !IRManager::can_lower(*instr)) {
                 break;
             }
+            current_ip += 2;
             const auto& inst = *instr;
 
             if (!inst.is_skip_next()) {
@@ -47,49 +55,250 @@ namespace jip {
                 if (inst.type() == InstructionType::Jump) {
                     // Check for self jumps
                     const auto target = instr->immediate();
-                    if (target <= current_ip && target >= ip) {
+                    this->m_instructions.emplace_back(instr.value());
+                    if (target < current_ip && target >= ip && (target - ip) % 2 == 0) {
                         // We know this jumps into a spot we recognise
                         this->m_local_jump_points.emplace_back(target);
+                        this->m_loop_headers.emplace_back(target);
+                        this->note_idle_loop(target);
                     }
-                    this->m_instructions.emplace_back(instr.value());
                     break;
                 }
 
+                if (inst.type() == InstructionType::Call) {
+                    if (const auto body = this->leaf_body(memory, inst.immediate()); body.has_value()) {
+                        this->m_instructions.insert(this->m_instructions.end(), body->begin(), body->end());
+                        continue;
+                    }
+                }
+
                 this->m_instructions.emplace_back(instr.value());
                 if (inst.changes_control_flow()) {
                     // Means it's a call or a return
                     break;
                 }
             } else {
-                this->m_instructions.emplace_back(instr.value());
-                if (!stream.has_next()) {
-                    // we can assume some kind of SMC possibly is happening
+                // A skip can't be left without the instruction it skips, so without one the block ends before it. The
+                // same goes for a skip guarding another skip, which the IR's skip blocks can't express
+                const auto next_instr = stream.has_next() ? this->decode_instruction(stream.next_word(), current_ip)
+                                                          : std::nullopt;
+                if (!next_instr.has_value() || !IRManager::can_lower(*next_instr) || next_instr->is_skip_next()) {
+                    current_ip -= 2;
                     break;
                 }
-
-                const auto next_instr = this->decode_instruction(stream.next_word());
-                if (!next_instr.has_value()) {
-                    break; // Again, assume SMC and bork the block
-                }
+                this->m_instructions.emplace_back(instr.value());
                 const auto& next_inst = *next_instr;
                 current_ip += 2;
 
                 this->m_local_jump_points.emplace_back(current_ip); // Skip the current instruction
+                this->m_instructions.emplace_back(next_inst);
                 if (next_inst.changes_control_flow()) {
                     if (next_inst.type() == InstructionType::Jump) {
                         const auto target = next_inst.immediate();
-                        if (target <= current_ip || target >= ip) {
+                        if (target < current_ip && target >= ip && (target - ip) % 2 == 0) {
                             this->m_local_jump_points.emplace_back(target);
+                            this->m_loop_headers.emplace_back(target);
+                            this->note_idle_loop(target);
                         }
                     }
                 }
+            }
+        }
 
-                this->m_instructions.emplace_back(next_inst);
+        this->m_end_ip = current_ip;
+    }
+
+    std::optional<std::vector<Instruction>>
+    InstructionList::leaf_body(const std::span<const uint8_t> memory, const uint16_t target) {
+        std::vector<Instruction> body{};
+
+        for (auto address = target; address + 1 < memory.size(); address += 2) {
+            const auto instr =
+                this->decode_instruction(static_cast<uint16_t>(memory[address] << 8 | memory[address + 1]), address);
+            if (!instr.has_value() || !IRManager::can_lower(*instr)) {
+                return std::nullopt;
+            }
+
+            if (instr->type() == InstructionType::Native && instr->immediate() == 0xEE) {
+                return body;
+            }
+
+            // Anything that can leave the subroutine would make the missing stack frame observable, and that includes
+            // a write into code, which exits the block straight after it
+            if (instr->changes_control_flow() || instr->type() == InstructionType::RangeWrite ||
+                instr->type() == InstructionType::BCD || body.size() == MaxLeafLength) {
+                return std::nullopt;
+            }
+            body.emplace_back(*instr);
+        }
+
+        return std::nullopt;
+    }
+
+    void InstructionList::note_idle_loop(const uint16_t header) noexcept {
+        const auto first = std::ranges::find(this->m_instructions, header, &Instruction::address);
+        if (first == this->m_instructions.end()) {
+            return;
+        }
+
+        // Loading the delay timer and skipping leave every iteration in the same state as the one before it, so only
+        // a timer tick or a key press can ever let the loop end
+        auto event = WaitEvent::Input;
+        for (const auto& instr : std::ranges::subrange(first, this->m_instructions.end() - 1)) {
+            switch (instr.type()) {
+            case InstructionType::LoadRegDelay:
+                event = WaitEvent::TimerTick;
+                break;
+            case InstructionType::SkipEqRegImm:
+            case InstructionType::SkipNeRegImm:
+            case InstructionType::SkipEqRegReg:
+            case InstructionType::SkipNeRegReg:
+            case InstructionType::SkipKeyDown:
+            case InstructionType::SkipKeyUp:
+                break;
+            default:
+                return;
             }
         }
+
+        this->m_instructions.back().m_idle_wait = event;
+    }
+
+    void InstructionList::create_trace(
+        const std::span<const uint8_t> memory, const uint16_t ip, const SkipProfile& profile
+    ) {
+        std::vector<uint16_t> visited{};
+        std::vector<uint16_t> return_addresses{}; // One per call inlined so far which hasn't been returned from yet
+        auto current_ip = ip;
+
+        const auto fetch = [&](const uint16_t address) -> std::optional<Instruction> {
+            if (address + 1 >= memory.size() || std::ranges::contains(visited, address)) {
+                return std::nullopt;
+            }
+
+            // The trace ends in front of anything the JIT can't lower, just like a block
+            auto instr =
+                this->decode_instruction(static_cast<uint16_t>(memory[address] << 8 | memory[address + 1]), address);
+            if (instr.has_value() && !IRManager::can_lower(*instr)) {
+                return std::nullopt;
+            }
+            return instr;
+        };
+
+        const auto usually_falls_through = [&](const uint16_t address) {
+            return (address & 1) == 0 && profile.test(address >> 1);
+        };
+
+        // A jump back to an instruction the trace already holds closes a loop, unless inlined leaf bodies make the
+        // address ambiguous. Called with the jump already appended
+        const auto note_back_edge = [&](const uint16_t target) {
+            const auto copies = std::ranges::count(this->m_instructions, target, &Instruction::address);
+            if (copies == 1 && std::ranges::contains(visited, target)) {
+                this->m_local_jump_points.emplace_back(target);
+                this->m_loop_headers.emplace_back(target);
+                this->note_idle_loop(target);
+            }
+        };
+
+        while (this->m_instructions.size() < MaxTraceLength) {
+            auto instr = fetch(current_ip);
+            if (!instr.has_value()) {
+                break;
+            }
+
+            if (instr->is_skip_next()) {
+                const auto skipped_ip = static_cast<uint16_t>(current_ip + 2);
+                const auto skipped = fetch(skipped_ip);
+                // A skip guarding another skip can't be expressed by the IR's skip blocks, so the trace ends in front
+                // of it. Starting on one leaves nothing to compile, the interpreter runs the pair instead
+                if (!skipped.has_value() || skipped->is_skip_next()) {
+                    break;
+                }
+
+                // Key skips aren't supported by the JIT's side exits, they always go through the skip block
+                const auto can_exit = instr->type() != InstructionType::SkipKeyDown &&
+                                      instr->type() != InstructionType::SkipKeyUp;
+                if (can_exit && skipped->type() == InstructionType::Jump && usually_falls_through(current_ip) &&
+                    !std::ranges::contains(visited, skipped->immediate())) {
+                    instr->m_exits_on_skip = true;
+                    this->m_instructions.emplace_back(*instr);
+                    visited.insert(visited.end(), { current_ip, skipped_ip });
+                    current_ip = skipped->immediate();
+                    continue;
+                }
+
+                // Same shape as create_block, both directions stay inside the trace until the skipped instruction
+                this->m_instructions.emplace_back(*instr);
+                this->m_instructions.emplace_back(*skipped);
+                visited.insert(visited.end(), { current_ip, skipped_ip });
+                if (skipped->type() == InstructionType::Jump) {
+                    note_back_edge(skipped->immediate());
+                }
+                current_ip += 4;
+                this->m_local_jump_points.emplace_back(current_ip);
+                continue;
+            }
+
+            visited.emplace_back(current_ip);
+            const auto next_ip = static_cast<uint16_t>(current_ip + 2);
+
+            switch (instr->type()) {
+            case InstructionType::Jump:
+                if (!std::ranges::contains(visited, instr->immediate())) {
+                    current_ip = instr->immediate();
+                    continue;
+                }
+                this->m_instructions.emplace_back(*instr);
+                note_back_edge(instr->immediate());
+                this->m_end_ip = instr->immediate();
+                return;
+            case InstructionType::Call:
+                if (const auto body = this->leaf_body(memory, instr->immediate()); body.has_value()) {
+                    this->m_instructions.insert(this->m_instructions.end(), body->begin(), body->end());
+                    current_ip = next_ip;
+                    continue;
+                }
+
+                if (return_addresses.size() < StackDepth && !std::ranges::contains(visited, instr->immediate())) {
+                    instr->m_inlined = true;
+                    this->m_instructions.emplace_back(*instr);
+                    return_addresses.emplace_back(next_ip);
+                    current_ip = instr->immediate();
+                    continue;
+                }
+                this->m_instructions.emplace_back(*instr);
+                this->m_end_ip = instr->immediate();
+                return;
+            case InstructionType::LongJump:
+                this->m_instructions.emplace_back(*instr);
+                this->m_end_ip = next_ip;
+                return;
+            case InstructionType::Native:
+                if (instr->immediate() == 0xEE) {
+                    this->m_instructions.emplace_back(*instr);
+                    if (return_addresses.empty()) {
+                        this->m_end_ip = next_ip;
+                        return;
+                    }
+
+                    // Nothing can touch the guest stack but calls and returns, so this pops what our call pushed
+                    this->m_instructions.back().m_inlined = true;
+                    current_ip = return_addresses.back();
+                    return_addresses.pop_back();
+                    continue;
+                }
+                [[fallthrough]];
+            default:
+                this->m_instructions.emplace_back(*instr);
+                current_ip = next_ip;
+                continue;
+            }
+        }
+
+        this->m_end_ip = current_ip;
     }
 
-    std::optional<Instruction> InstructionList::decode_instruction(uint16_t bytes) {
+    std::optional<Instruction> InstructionList::decode_instruction(uint16_t bytes, const uint16_t address) {
         using RegVec = cip::StaticVector<uint8_t, 2, uint8_t>;
         const auto type = compute_type(bytes);
         if (type == InstructionType::Invalid) {
@@ -180,7 +389,7 @@ namespace jip {
 
         Instruction instr{
             static_cast<uint8_t>(std::get<0>(instr_info)),  control_flow_change, type, std::get<1>(instr_info),
-            static_cast<uint16_t>(std::get<2>(instr_info)),
+            static_cast<uint16_t>(std::get<2>(instr_info)), address,
         };
 
         return instr;
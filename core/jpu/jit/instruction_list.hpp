@@ -1,13 +1,19 @@
 #pragma once
 #include "instruction_info.hpp"
+#include "jpu/core.hpp"
 #include "util/memory_stream.hpp"
 #include "util/static_stack.hpp"
 
+#include <bitset>
 #include <cstdint>
 #include <optional>
+#include <span>
 #include <vector>
 
 namespace jip {
+    // Bit `ip >> 1` is set for skips the guest usually doesn't take, so traces follow the instruction they guard
+    using SkipProfile = std::bitset<MemorySize / 2>;
+
     class Instruction {
     public:
         Instruction() = default;
@@ -17,16 +23,26 @@ namespace jip {
         [[nodiscard]] bool changes_control_flow() const noexcept { return m_changes_control_flow; }
         [[nodiscard]] InstructionType type() const noexcept { return m_type; }
         [[nodiscard]] const auto& used_regs() const noexcept { return m_used_regs; }
+        [[nodiscard]] uint16_t address() const noexcept { return m_address; }
+
+        // A call or return the trace continues through instead of leaving
+        [[nodiscard]] bool is_inlined() const noexcept { return m_inlined; }
+
+        // A skip guarding a jump the trace follows, taking the skip leaves the trace
+        [[nodiscard]] bool exits_on_skip() const noexcept { return m_exits_on_skip; }
+
+        // For the back edge of a loop which can't change anything but the registers it loads from the timers
+        [[nodiscard]] WaitEvent idle_wait() const noexcept { return m_idle_wait; }
 
         [[nodiscard]] bool is_skip_next() const noexcept;
 
     private:
         Instruction(
             const uint8_t used_regs, const bool changes_control_flow, const InstructionType type,
-            const cip::StaticVector<uint8_t, 2, uint8_t> regs, const uint16_t immediate
+            const cip::StaticVector<uint8_t, 2, uint8_t> regs, const uint16_t immediate, const uint16_t address
         ) noexcept
             : m_regs_used(used_regs), m_immediate(immediate), m_used_regs(regs),
-              m_changes_control_flow(changes_control_flow), m_type(type) {}
+              m_changes_control_flow(changes_control_flow), m_type(type), m_address(address) {}
 
         friend class InstructionList;
         uint16_t m_immediate{ 0 };
@@ -34,6 +50,10 @@ namespace jip {
         bool m_changes_control_flow{ false };
         cip::StaticVector<uint8_t, 2, uint8_t> m_used_regs{};
         InstructionType m_type{};
+        uint16_t m_address{ 0 };
+        bool m_inlined{ false };
+        bool m_exits_on_skip{ false };
+        WaitEvent m_idle_wait{ WaitEvent::None };
     };
 
     class InstructionList {
@@ -46,14 +66,40 @@ namespace jip {
 
         [[nodiscard]] Instruction at(const uint16_t index) const noexcept { return m_instructions.at(index); }
 
-        void create_block(MemoryStream stream, uint16_t ip);
+        [[nodiscard]] size_t size() const noexcept { return m_instructions.size(); }
+
+        // `memory` is the whole of guest memory, calls to short leaf subroutines are inlined from wherever they live
+        void create_block(std::span<const uint8_t> memory, uint16_t ip);
+
+        // Records the path execution most likely takes from `ip`, continuing through constant jumps, calls, returns
+        // to a call made earlier in the trace and jumps guarded by a skip the profile says isn't usually taken
+        void create_trace(std::span<const uint8_t> memory, uint16_t ip, const SkipProfile& profile);
+
         const auto& jump_points() const noexcept { return m_local_jump_points; }
 
+        // Jump points which are the target of a later jump back into the same block
+        const auto& loop_headers() const noexcept { return m_loop_headers; }
+
+        // Where execution continues once the last instruction has run, unless that instruction left by itself
+        [[nodiscard]] uint16_t end_ip() const noexcept { return m_end_ip; }
+
+        constexpr static size_t MaxTraceLength = 64;
+        constexpr static size_t MaxLeafLength = 8;
+
     private:
-        std::optional<Instruction> decode_instruction(uint16_t bytes);
+        std::optional<Instruction> decode_instruction(uint16_t bytes, uint16_t address);
+
+        // The body of the subroutine at `target` if it's straight line code ending in a 00EE, short enough to inline.
+        // Nothing in such a body can observe the stack, so the call and return disappear entirely
+        std::optional<std::vector<Instruction>> leaf_body(std::span<const uint8_t> memory, uint16_t target);
+
+        // Called with the back edge to `header` just appended, marks it if the loop only polls the timers or keys
+        void note_idle_loop(uint16_t header) noexcept;
 
     private:
         std::vector<Instruction> m_instructions;
         std::vector<uint32_t> m_local_jump_points;
+        std::vector<uint32_t> m_loop_headers;
+        uint16_t m_end_ip{ 0 };
     };
 } // namespace jip
\ No newline at end of file
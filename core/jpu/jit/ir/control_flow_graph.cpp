@@ -0,0 +1,221 @@
+#include "control_flow_graph.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <ranges>
+#include <utility>
+
+namespace jip {
+    ControlFlowGraph::ControlFlowGraph(const IRManager& manager) {
+        const auto& blocks = manager.blocks();
+        const auto count = blocks.size();
+        this->m_successors.resize(count);
+        this->m_predecessors.resize(count);
+        this->m_exits.resize(count);
+        this->m_immediate_dominators.assign(count, Unreachable);
+        this->m_dominance_frontiers.resize(count);
+
+        for (size_t index = 0; index < count; index++) {
+            const auto from = static_cast<uint16_t>(index);
+            const auto& instructions = blocks[index].instructions();
+            auto falls_through = true;
+
+            for (size_t i = 0; i < instructions.size() && falls_through; i++) {
+                const auto& instruction = instructions[i];
+                const auto position = static_cast<uint32_t>(i);
+
+                if (is_branch(instruction.code)) {
+                    // Frontiers and phis are per block, a branch leaving mid-block would hand its target the values
+                    // of the whole block rather than those live at the branch
+                    assert(IRManager::is_terminator(instruction.code) || i + 1 == instructions.size());
+                    const auto to = static_cast<uint16_t>(branch_target(instruction));
+                    this->m_successors[from].emplace_back(from, to, position);
+                    this->m_predecessors[to].emplace_back(from, to, position);
+                }
+
+                if (leaves_block(instruction.code)) {
+                    this->m_exits[from].emplace_back(position);
+                }
+
+                // Anything after a terminator never runs
+                falls_through = !IRManager::is_terminator(instruction.code);
+            }
+
+            if (!falls_through) {
+                continue;
+            }
+
+            const auto end = static_cast<uint32_t>(instructions.size());
+            if (index + 1 < count) {
+                const auto to = static_cast<uint16_t>(index + 1);
+                this->m_successors[from].emplace_back(from, to, end);
+                this->m_predecessors[to].emplace_back(from, to, end);
+            } else {
+                this->m_exits[from].emplace_back(end);
+            }
+        }
+
+        if (count == 0) {
+            return;
+        }
+
+        this->compute_reverse_postorder();
+        this->compute_dominators();
+        this->compute_dominance_frontiers();
+    }
+
+    std::optional<uint16_t> ControlFlowGraph::immediate_dominator(const uint16_t block) const noexcept {
+        if (block == 0 || !this->reachable(block)) {
+            return std::nullopt;
+        }
+
+        return this->m_immediate_dominators[block];
+    }
+
+    bool ControlFlowGraph::dominates(const uint16_t dominator, uint16_t block) const noexcept {
+        if (!this->reachable(block)) {
+            return false;
+        }
+
+        while (block != dominator && block != 0) {
+            block = this->m_immediate_dominators[block];
+        }
+
+        return block == dominator;
+    }
+
+    void ControlFlowGraph::compute_reverse_postorder() {
+        std::vector<bool> visited(this->m_successors.size(), false);
+        std::vector<std::pair<uint16_t, size_t>> stack{ { 0, 0 } }; // Block, and the next successor to visit
+        visited[0] = true;
+
+        while (!stack.empty()) {
+            auto& [block, next] = stack.back();
+            if (next == this->m_successors[block].size()) {
+                this->m_reverse_postorder.emplace_back(block);
+                stack.pop_back();
+                continue;
+            }
+
+            const auto to = this->m_successors[block][next++].to;
+            if (!visited[to]) {
+                visited[to] = true;
+                stack.emplace_back(to, 0);
+            }
+        }
+
+        std::ranges::reverse(this->m_reverse_postorder);
+    }
+
+    void ControlFlowGraph::compute_dominators() {
+        std::vector<size_t> order(this->m_successors.size(), 0);
+        for (const auto& [index, block] : this->m_reverse_postorder | std::views::enumerate) {
+            order[block] = static_cast<size_t>(index);
+        }
+
+        auto& dominators = this->m_immediate_dominators;
+        const auto intersect = [&](uint16_t a, uint16_t b) {
+            while (a != b) {
+                while (order[a] > order[b]) {
+                    a = dominators[a];
+                }
+                while (order[b] > order[a]) {
+                    b = dominators[b];
+                }
+            }
+            return a;
+        };
+
+        dominators[0] = 0;
+        for (auto changed = true; changed;) {
+            changed = false;
+            for (const auto block : this->m_reverse_postorder | std::views::drop(1)) {
+                auto dominator = Unreachable;
+                for (const auto& edge : this->m_predecessors[block]) {
+                    // Predecessors not processed yet are reached through a back edge, and the others are enough
+                    if (dominators[edge.from] == Unreachable) {
+                        continue;
+                    }
+                    dominator = dominator == Unreachable ? edge.from : intersect(edge.from, dominator);
+                }
+
+                if (dominators[block] != dominator) {
+                    dominators[block] = dominator;
+                    changed = true;
+                }
+            }
+        }
+    }
+
+    void ControlFlowGraph::compute_dominance_frontiers() {
+        for (const auto block : this->m_reverse_postorder) {
+            // The entry is also entered from outside the compiled code, a join for as soon as anything jumps back to
+            // it. Nothing dominates it, so walks up from its predecessors run all the way to the entry itself
+            const auto& predecessors = this->m_predecessors[block];
+            const auto from_outside = block == 0 ? 1u : 0u;
+            if (predecessors.size() + from_outside < 2) {
+                continue;
+            }
+            const auto stop = block == 0 ? Unreachable : this->m_immediate_dominators[block];
+
+            for (const auto& edge : predecessors) {
+                if (!this->reachable(edge.from)) {
+                    continue;
+                }
+
+                for (auto runner = edge.from; runner != stop; runner = this->m_immediate_dominators[runner]) {
+                    auto& frontier = this->m_dominance_frontiers[runner];
+                    if (!std::ranges::contains(frontier, block)) {
+                        frontier.emplace_back(block);
+                    }
+
+                    if (runner == 0) {
+                        break;
+                    }
+                }
+            }
+        }
+    }
+
+    bool ControlFlowGraph::is_branch(const IROpcode code) noexcept {
+        switch (code) {
+        case IROpcode::JmpZ:
+        case IROpcode::JmpNZ:
+        case IROpcode::JmpEqImm:
+        case IROpcode::JmpNeImm:
+        case IROpcode::JmpEqReg:
+        case IROpcode::JmpNeReg:
+        case IROpcode::JmpKeyDown:
+        case IROpcode::JmpKeyUp:
+        case IROpcode::JmpBlock:
+        case IROpcode::LoopBackEdge:
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    bool ControlFlowGraph::leaves_block(const IROpcode code) noexcept {
+        switch (code) {
+        case IROpcode::JmpJit:
+        case IROpcode::JmpDynamic:
+        case IROpcode::IdleWait:
+        case IROpcode::LoopBackEdge: // Once the budget runs out
+        case IROpcode::ExitIfCodeWritten:
+        case IROpcode::JumpToStackWithOffsetAndDecrement:
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    uint32_t ControlFlowGraph::branch_target(const IRInstruction& instruction) noexcept {
+        switch (instruction.code) {
+        case IROpcode::JmpEqImm:
+        case IROpcode::JmpNeImm:
+            return instruction.immediate_2;
+        default:
+            return instruction.immediate;
+        }
+    }
+} // namespace jip
@@ -0,0 +1,80 @@
+#pragma once
+#include "ir_manager.hpp"
+
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <vector>
+
+namespace jip {
+    // The edges between an IRManager's blocks, which the IR itself only holds in the jump instructions' immediates.
+    // Branches always end their block but exits can sit anywhere in one, so every edge and exit records the instruction
+    // it's taken after. Only valid until the blocks change, passes that add or drop branches have to build a new one
+    class ControlFlowGraph {
+    public:
+        struct Edge {
+            uint16_t from{};
+            uint16_t to{};
+            uint32_t position{}; // The branch's index in `from`, or its size for falling through
+        };
+
+        explicit ControlFlowGraph(const IRManager& manager);
+
+        [[nodiscard]] size_t block_count() const noexcept { return this->m_successors.size(); }
+
+        [[nodiscard]] std::span<const Edge> successors(const uint16_t block) const noexcept {
+            return this->m_successors[block];
+        }
+
+        // In the order they were found, a phi's operands line up with these
+        [[nodiscard]] std::span<const Edge> predecessors(const uint16_t block) const noexcept {
+            return this->m_predecessors[block];
+        }
+
+        // Where control leaves the compiled code from `block`, as instruction indices like Edge::position
+        [[nodiscard]] std::span<const uint32_t> exits(const uint16_t block) const noexcept {
+            return this->m_exits[block];
+        }
+
+        // Every block reachable from the entry, each after all of its predecessors bar those reached by a back edge
+        [[nodiscard]] std::span<const uint16_t> reverse_postorder() const noexcept { return this->m_reverse_postorder; }
+
+        [[nodiscard]] bool reachable(const uint16_t block) const noexcept {
+            return block == 0 || this->m_immediate_dominators[block] != Unreachable;
+        }
+
+        // Nothing for the entry and for unreachable blocks
+        [[nodiscard]] std::optional<uint16_t> immediate_dominator(uint16_t block) const noexcept;
+
+        [[nodiscard]] bool dominates(uint16_t dominator, uint16_t block) const noexcept;
+
+        // Where what `block` defines stops being the only definition reaching, which is where SSA needs its phis
+        [[nodiscard]] std::span<const uint16_t> dominance_frontier(const uint16_t block) const noexcept {
+            return this->m_dominance_frontiers[block];
+        }
+
+        // Jumps to another block of the same IR, conditional or not
+        [[nodiscard]] static bool is_branch(IROpcode code) noexcept;
+
+        // Hands control to whatever runs after the compiled code, on at least one path
+        [[nodiscard]] static bool leaves_block(IROpcode code) noexcept;
+
+        [[nodiscard]] static uint32_t branch_target(const IRInstruction& instruction) noexcept;
+
+    private:
+        void compute_reverse_postorder();
+        // Cooper, Harvey and Kennedy's iterative algorithm, blocks only have a handful of predecessors each
+        void compute_dominators();
+        void compute_dominance_frontiers();
+
+    private:
+        constexpr static uint16_t Unreachable = UINT16_MAX;
+
+        std::vector<std::vector<Edge>> m_successors{};
+        std::vector<std::vector<Edge>> m_predecessors{};
+        std::vector<std::vector<uint32_t>> m_exits{};
+        std::vector<uint16_t> m_reverse_postorder{};
+        std::vector<uint16_t> m_immediate_dominators{}; // The entry dominates itself
+        std::vector<std::vector<uint16_t>> m_dominance_frontiers{};
+    };
+} // namespace jip
@@ -1,7 +1,6 @@
 #include "ir_manager.hpp"
 
 #include <algorithm>
-#include <print>
 #include <stdexcept>
 #include <utility>
 
@@ -19,22 +18,55 @@ namespace jip {
     }
 
     void IRManager::emit(const Instruction instr, const uint16_t current_ip) {
-        if (std::ranges::contains(this->m_new_block_points, current_ip)) {
+        this->m_emitted_instructions++;
+
+        // Skips and loop headers create blocks ahead of using them, which have to come after the entry block. Else a
+        // skip first thing would make its target the entry, and a loop header first thing would put its back edge in
+        // front of the preheader
+        if (this->m_active_handle.m_owner == nullptr) {
+            this->m_active_handle = this->new_block();
+            this->m_active_handle.use_block();
+        }
+
+        // A skip target already has its block, giving it a second one would leave jumps to it landing on an empty
+        // block laid out after the real one
+        if (this->m_block_switch_counter != 0 && --this->m_block_switch_counter == 0) {
+            this->m_handle_to_switch.use_block();
+        } else if (this->m_block_switch_counter != 0) {
+            // The instruction a skip guards gets its own block, laid out between the skip and its target, so the skip's
+            // branch always ends its block and what the guarded instruction defines only reaches the target through a
+            // phi. A jump landing on it lands on that block too
+            this->m_skipped_handle.use_block();
+            if (std::ranges::contains(this->m_new_block_points, current_ip)) {
+                this->m_block_point_to_block_index[current_ip] = this->m_skipped_handle.index();
+            }
+        } else if (std::ranges::contains(this->m_new_block_points, current_ip)) {
+            const auto block_index = static_cast<uint32_t>(this->m_blocks.size());
+
+            // Loop headers are only entered by falling through into them or from their back edge, so the preheader
+            // sits at the end of the block before. Headers which are also skip targets have a second way in and are
+            // left as plain exits, and so are headers a skip guards, the skip being taken jumps past the preheader
+            // straight into the loop body
+            if (std::ranges::contains(this->m_loop_headers, current_ip)) {
+                this->emit_instruction(
+                    { .code = IROpcode::LoopPreheader, .immediate = block_index, .immediate_2 = current_ip }
+                );
+                this->m_loop_header_blocks[current_ip] = { block_index, this->m_emitted_instructions };
+            }
+
             const auto block = this->new_block();
             block.use_block();
             this->m_block_point_to_block_index[current_ip] = block.index();
         }
 
-        if (this->m_block_switch_counter) {
-            const auto counter = --this->m_block_switch_counter;
-
-            if (counter == 0) {
-                this->m_handle_to_switch.use_block();
-            }
+        if (instr.exits_on_skip()) {
+            this->emit_skip_exit(instr);
+            return;
         }
 
         if (instr.is_skip_next()) {
             assert(std::ranges::contains(this->m_new_block_points, current_ip + 4));
+            this->m_skipped_handle = this->new_block();
             const auto block = this->new_block();
             this->m_block_point_to_block_index[current_ip + 4] = block.index();
             this->m_block_switch_counter = 2;
@@ -48,10 +80,14 @@ namespace jip {
                 return;
             }
             if (instr.immediate() == 0xEE) {
+                if (instr.is_inlined()) {
+                    this->emit_inlined_return(instr);
+                    return;
+                }
                 this->emit_return(instr);
                 return;
             }
-            throw std::logic_error(std::format("Unhandled native call, {:x}", instr.immediate()));
+            break;
         case InstructionType::LoadImm:
             this->emit_load_imm(instr);
             return;
@@ -67,6 +103,9 @@ namespace jip {
         case InstructionType::Jump:
             this->emit_jump(instr);
             return;
+        case InstructionType::LongJump:
+            this->emit_long_jump(instr);
+            return;
         case InstructionType::SkipEqRegImm:
             this->emit_skip_reg_eq_imm(instr);
             return;
@@ -79,6 +118,17 @@ namespace jip {
         case InstructionType::SkipNeRegReg:
             this->emit_skip_reg_ne_reg(instr);
             return;
+        case InstructionType::SkipKeyDown:
+        case InstructionType::SkipKeyUp:
+            this->emit_skip_key(instr);
+            return;
+        case InstructionType::LoadRegDelay:
+            this->emit_read_timer(instr);
+            return;
+        case InstructionType::LoadDelayReg:
+        case InstructionType::SetSoundReg:
+            this->emit_write_timer(instr);
+            return;
         case InstructionType::Call:
             this->emit_call(instr, current_ip);
             return;
@@ -109,18 +159,96 @@ namespace jip {
         case InstructionType::RegShlXY:
             this->emit_reg_shl_xy(instr);
             return;
+        case InstructionType::IAddReg:
+            this->emit_index_add_reg(instr);
+            return;
         case InstructionType::RangeRead:
             this->emit_range_read(instr);
             return;
         case InstructionType::RangeWrite:
-            // this->emit_range_write(instr);
-            // return;
+            this->emit_range_write(instr, current_ip);
+            return;
+        case InstructionType::BCD:
+            this->emit_bcd(instr, current_ip);
+            return;
+        default:
+            break;
+        }
+
+        // can_lower keeps these out of instruction lists, anything slipping through leaves the IR incomplete
+        if (!this->m_unlowered.has_value()) {
+            this->m_unlowered = instr.type();
+        }
+    }
+
+    bool IRManager::can_lower(const Instruction& instr) noexcept {
+        switch (instr.type()) {
+        case InstructionType::Native:
+            return instr.immediate() == 0xE0 || instr.immediate() == 0xEE;
+        case InstructionType::LoadImm:
+        case InstructionType::LoadImmI:
+        case InstructionType::AddImm:
+        case InstructionType::Draw:
+        case InstructionType::Jump:
+        case InstructionType::LongJump:
+        case InstructionType::SkipEqRegImm:
+        case InstructionType::SkipNeRegImm:
+        case InstructionType::SkipEqRegReg:
+        case InstructionType::SkipNeRegReg:
+        case InstructionType::SkipKeyDown:
+        case InstructionType::SkipKeyUp:
+        case InstructionType::LoadRegDelay:
+        case InstructionType::LoadDelayReg:
+        case InstructionType::SetSoundReg:
+        case InstructionType::Call:
+        case InstructionType::MovReg:
+        case InstructionType::RegOr:
+        case InstructionType::RegAnd:
+        case InstructionType::RegXor:
+        case InstructionType::RegAddYX:
+        case InstructionType::RegSubXY:
+        case InstructionType::RegSubYX:
+        case InstructionType::RegShrXY:
+        case InstructionType::RegShlXY:
+        case InstructionType::IAddReg:
+        case InstructionType::RangeRead:
+        case InstructionType::RangeWrite:
         case InstructionType::BCD:
-            // this->emit_bcd(instr);
-            // return;
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    void IRManager::close_block(const uint16_t next_ip) {
+        // A skip at the very end of the block still has its target pending, so it has to be entered before the exit is
+        // emitted else the skip would fall off the end of the machine code
+        if (this->m_block_switch_counter) {
+            this->m_block_switch_counter = 0;
+            this->m_handle_to_switch.use_block();
+        }
+
+        if (this->m_active_handle.m_owner != nullptr) {
+            const auto& instructions = this->m_blocks[this->m_active_handle.m_index].instructions();
+            if (!instructions.empty() && is_terminator(instructions.back().code)) {
+                return;
+            }
+        }
+
+        this->emit_instruction({ .code = IROpcode::JmpJit, .immediate = next_ip });
+    }
+
+    bool IRManager::is_terminator(const IROpcode code) noexcept {
+        switch (code) {
+        case IROpcode::JmpBlock:
+        case IROpcode::JmpJit:
+        case IROpcode::JmpDynamic:
+        case IROpcode::LoopBackEdge:
+        case IROpcode::IdleWait:
+        case IROpcode::JumpToStackWithOffsetAndDecrement:
+            return true;
         default:
-            std::println("Unhandled instruction type: {:x}", static_cast<uint32_t>(instr.type()));
-            // throw std::runtime_error("Unhandled instruction type");
+            return false;
         }
     }
 
@@ -204,7 +332,10 @@ namespace jip {
                     { IROpcode::AndImm, sprite_byte_pointer, byte_scratch_pointer, static_cast<uint16_t>(0x80 >> x) }
                 );
 
+                // Every branch ends its block, so each bounds check falls through into a block of its own
                 const auto succeed_block = this->new_block();
+                const auto x_in_bounds_block = this->new_block();
+                const auto y_in_bounds_block = this->new_block();
                 const auto fail_block = this->new_block();
 
                 this->emit_instruction(
@@ -221,6 +352,8 @@ namespace jip {
                     { .code = IROpcode::JmpNZ, .vx = byte_scratch_pointer, .immediate = fail_block.m_index }
                 );
 
+                x_in_bounds_block.use_block();
+
                 this->emit_instruction(
                     { IROpcode::AndImm, dy_pointer, byte_scratch_pointer, static_cast<uint16_t>(~31) }
                 );
@@ -228,6 +361,8 @@ namespace jip {
                     { .code = IROpcode::JmpNZ, .vx = byte_scratch_pointer, .immediate = fail_block.m_index }
                 );
 
+                y_in_bounds_block.use_block();
+
                 this->emit_instruction(
                     { IROpcode::XorDisplayMemory, dx_pointer, dy_pointer, static_cast<uint16_t>(fail_block.index()) }
                 );
@@ -267,12 +402,28 @@ namespace jip {
 
     void IRManager::emit_jump(const Instruction instr) {
         assert(instr.type() == InstructionType::Jump);
+        if (instr.idle_wait() != WaitEvent::None) {
+            this->emit_instruction(
+                { .code = IROpcode::IdleWait,
+                  .immediate = instr.immediate(),
+                  .immediate_2 = static_cast<uint32_t>(instr.idle_wait()) }
+            );
+            return;
+        }
+
+        if (this->m_loop_header_blocks.contains(instr.immediate())) {
+            this->emit_self_jump(instr);
+            return;
+        }
+
         this->emit_jit_jump(instr);
     }
 
     void IRManager::emit_self_jump(const Instruction instr) {
-        const auto target_block = this->m_block_point_to_block_index.at(instr.immediate());
-        this->emit_instruction({ .code = IROpcode::JmpBlock, .immediate = target_block });
+        const auto [target_block, first_instruction] = this->m_loop_header_blocks.at(instr.immediate());
+        // Every instruction from the header up to and including this jump runs once per iteration
+        const auto cost = this->m_emitted_instructions - first_instruction + 1;
+        this->emit_instruction({ .code = IROpcode::LoopBackEdge, .immediate = target_block, .immediate_2 = cost });
     }
 
     void IRManager::emit_jit_jump(const Instruction instr) {
@@ -280,6 +431,14 @@ namespace jip {
         this->emit_instruction({ .code = IROpcode::JmpJit, .immediate = target_ip });
     }
 
+    void IRManager::emit_long_jump(const Instruction instr) {
+        assert(instr.type() == InstructionType::LongJump);
+        const auto v0_pointer = RegisterPointer{ false, this->alloc_temp_for_reg(IRReg::V0) };
+
+        // The target is V0 + NNN, so it can only be resolved through the dispatch table at runtime
+        this->emit_instruction({ .code = IROpcode::JmpDynamic, .vx = v0_pointer, .immediate = instr.immediate() });
+    }
+
     void IRManager::emit_skip_reg_eq_imm(const Instruction instr) {
         assert(instr.type() == InstructionType::SkipEqRegImm);
         assert(this->m_block_switch_counter == 2);
@@ -340,6 +499,45 @@ namespace jip {
         );
     }
 
+    void IRManager::emit_skip_key(const Instruction instr) {
+        assert(instr.type() == InstructionType::SkipKeyDown || instr.type() == InstructionType::SkipKeyUp);
+        assert(this->m_block_switch_counter == 2);
+        const auto x_reg = static_cast<IRReg>(instr.used_regs()[0]);
+
+        const auto x_pointer = RegisterPointer{ false, this->alloc_temp_for_reg(x_reg) };
+        const auto scratch_pointer = RegisterPointer{ true, this->new_temp() };
+        this->emit_instruction(
+            { .code = instr.type() == InstructionType::SkipKeyDown ? IROpcode::JmpKeyDown : IROpcode::JmpKeyUp,
+              .vx = x_pointer,
+              .immediate = this->m_handle_to_switch.index(),
+              .extra_consumed_registers = { std::pair{ scratch_pointer, RegisterAccessInfo::VYWrite } } }
+        );
+    }
+
+    void IRManager::emit_read_timer(const Instruction instr) {
+        assert(instr.type() == InstructionType::LoadRegDelay);
+        const auto reg = static_cast<IRReg>(instr.used_regs()[0]);
+
+        this->emit_instruction(
+            { .code = IROpcode::ReadTimer,
+              .vx = RegisterPointer{ false, this->alloc_temp_for_reg(reg) },
+              .immediate = static_cast<uint32_t>(offsetof(CoreState, delay_timer)) }
+        );
+    }
+
+    void IRManager::emit_write_timer(const Instruction instr) {
+        assert(instr.type() == InstructionType::LoadDelayReg || instr.type() == InstructionType::SetSoundReg);
+        const auto reg = static_cast<IRReg>(instr.used_regs()[0]);
+        const auto timer = instr.type() == InstructionType::LoadDelayReg ? offsetof(CoreState, delay_timer)
+                                                                         : offsetof(CoreState, sound_timer);
+
+        this->emit_instruction(
+            { .code = IROpcode::WriteTimer,
+              .vx = RegisterPointer{ false, this->alloc_temp_for_reg(reg) },
+              .immediate = static_cast<uint32_t>(timer) }
+        );
+    }
+
     void IRManager::emit_call(const Instruction instr, const uint16_t current_ip) {
         assert(instr.type() == InstructionType::Call);
 
@@ -354,7 +552,10 @@ namespace jip {
         this->emit_instruction(
             { .code = IROpcode::WriteToStackWithOffset, .vx = stack_offset_pointer, .immediate = return_address }
         );
-        this->emit_instruction({ .code = IROpcode::JmpJit, .immediate = target_address });
+
+        if (!instr.is_inlined()) {
+            this->emit_instruction({ .code = IROpcode::JmpJit, .immediate = target_address });
+        }
     }
 
     void IRManager::emit_return(const Instruction instr) {
@@ -371,6 +572,61 @@ namespace jip {
         );
     }
 
+    void IRManager::emit_inlined_return(const Instruction instr) {
+        assert(instr.type() == InstructionType::Native);
+        assert(instr.immediate() == 0xEE);
+        const auto stack_offset_pointer = RegisterPointer{ true, this->new_temp() };
+
+        // The trace already knows where the matching call returns to, so all that's left is popping the stack
+        this->emit_instruction({ IROpcode::ReadStackOffset, stack_offset_pointer });
+        this->emit_instruction({ IROpcode::AddImm, stack_offset_pointer, stack_offset_pointer, 0xFF });
+        this->emit_instruction({ IROpcode::WriteStackOffset, stack_offset_pointer });
+    }
+
+    void IRManager::emit_skip_exit(const Instruction instr) {
+        const auto x_reg = static_cast<IRReg>(instr.used_regs()[0]);
+        const auto x_pointer = RegisterPointer{ false, this->alloc_temp_for_reg(x_reg) };
+        const auto exit_block = this->new_block();
+        const auto trace_block = this->new_block();
+        const auto exit_ip = static_cast<uint16_t>(instr.address() + 4);
+
+        // Branches over the side exit whenever the skip isn't taken, which is the direction the trace followed
+        switch (instr.type()) {
+        case InstructionType::SkipEqRegImm:
+            this->emit_instruction(
+                { .code = IROpcode::JmpNeImm,
+                  .vx = x_pointer,
+                  .immediate = instr.immediate(),
+                  .immediate_2 = trace_block.index() }
+            );
+            break;
+        case InstructionType::SkipNeRegImm:
+            this->emit_instruction(
+                { .code = IROpcode::JmpEqImm,
+                  .vx = x_pointer,
+                  .immediate = instr.immediate(),
+                  .immediate_2 = trace_block.index() }
+            );
+            break;
+        case InstructionType::SkipEqRegReg:
+        case InstructionType::SkipNeRegReg: {
+            const auto y_reg = static_cast<IRReg>(instr.used_regs()[1]);
+            const auto y_pointer = RegisterPointer{ false, this->alloc_temp_for_reg(y_reg) };
+            const auto code = instr.type() == InstructionType::SkipEqRegReg ? IROpcode::JmpNeReg : IROpcode::JmpEqReg;
+            this->emit_instruction(
+                { .code = code, .vx = x_pointer, .vy = y_pointer, .immediate = trace_block.index() }
+            );
+            break;
+        }
+        default:
+            throw std::logic_error("Unsupported skip for a side exit");
+        }
+
+        exit_block.use_block();
+        this->emit_instruction({ .code = IROpcode::JmpJit, .immediate = exit_ip });
+        trace_block.use_block();
+    }
+
     void IRManager::emit_mov_reg(const Instruction instr) {
         assert(instr.type() == InstructionType::MovReg);
 
@@ -380,7 +636,7 @@ namespace jip {
         const auto dst_pointer = RegisterPointer{ false, this->alloc_temp_for_reg(dst) };
         const auto src_pointer = RegisterPointer{ false, this->alloc_temp_for_reg(src) };
 
-        this->emit_instruction({ IROpcode::LoadReg, dst_pointer, src_pointer });
+        this->emit_instruction({ IROpcode::LoadReg, src_pointer, dst_pointer });
     }
 
     void IRManager::emit_reg_or(const Instruction instr) {
@@ -437,16 +693,16 @@ namespace jip {
         const auto dst_pointer = RegisterPointer{ false, this->alloc_temp_for_reg(dst) };
         const auto src_pointer = RegisterPointer{ false, this->alloc_temp_for_reg(src) };
         const auto vF = RegisterPointer{ false, this->alloc_temp_for_reg(IRReg::VF) };
+        const auto scratch_pointer = RegisterPointer{ true, this->new_temp() };
 
         this->emit_instruction(
-            {
-                IROpcode::Sub,
-                dst_pointer,
-                src_pointer,
-            }
+            { .code = IROpcode::Sub,
+              .vx = dst_pointer,
+              .vy = src_pointer,
+              .extra_consumed_registers = { std::pair{ scratch_pointer, RegisterAccessInfo::VYWrite } } }
         );
 
-        this->emit_instruction({ .code = IROpcode::FlagRegisterCheck, .vx = vF, .immediate = 0x55B });
+        this->emit_instruction({ .code = IROpcode::FlagRegisterCheck, .vx = vF, .immediate = 0x55B1 });
     }
 
     void IRManager::emit_reg_sub_yx(const Instruction instr) {
@@ -488,11 +744,28 @@ namespace jip {
         this->emit_instruction({ .code = IROpcode::FlagRegisterCheck, .vx = vF, .immediate = 0x5171 });
     }
 
+    void IRManager::emit_index_add_reg(const Instruction instr) {
+        assert(instr.type() == InstructionType::IAddReg);
+        const auto src = static_cast<IRReg>(instr.used_regs()[0]);
+
+        const auto index_pointer = RegisterPointer{ false, this->alloc_temp_for_reg(IRReg::IN) };
+        const auto src_pointer = RegisterPointer{ false, this->alloc_temp_for_reg(src) };
+        const auto scratch_pointer = RegisterPointer{ true, this->new_temp() };
+
+        this->emit_instruction(
+            { .code = IROpcode::AddIndexReg,
+              .vx = index_pointer,
+              .vy = src_pointer,
+              .extra_consumed_registers = { std::pair{ scratch_pointer, RegisterAccessInfo::VYWrite } } }
+        );
+    }
+
     void IRManager::emit_range_read(const Instruction instr) {
         assert(instr.type() == InstructionType::RangeRead);
         const auto last_reg = static_cast<IRReg>(instr.used_regs()[0]);
 
         const auto index_pointer = RegisterPointer{ false, this->alloc_temp_for_reg(IRReg::IN) };
+        const auto address_pointer = RegisterPointer{ true, this->new_temp() };
 
         for (int i = 0; i <= static_cast<int>(last_reg); ++i) {
             const auto vn_pointer = RegisterPointer{ false, this->alloc_temp_for_reg(static_cast<IRReg>(i)) };
@@ -500,36 +773,53 @@ namespace jip {
                 { .code = IROpcode::ReadFromMemory,
                   .vx = index_pointer,
                   .vy = vn_pointer,
-                  .immediate = static_cast<uint32_t>(i) }
-            );
-            this->emit_instruction(
-                { .code = IROpcode::AddImm, .vx = index_pointer, .vy = index_pointer, .immediate = 1 }
+                  .immediate = static_cast<uint32_t>(i),
+                  .extra_consumed_registers = { std::pair{ address_pointer, RegisterAccessInfo::VYWrite } } }
             );
         }
+
+        this->emit_instruction(
+            { .code = IROpcode::AddImm,
+              .vx = index_pointer,
+              .vy = index_pointer,
+              .immediate = static_cast<uint32_t>(last_reg) + 1 }
+        );
     }
 
-    void IRManager::emit_range_write(const Instruction instr) {
+    void IRManager::emit_range_write(const Instruction instr, const uint16_t current_ip) {
         assert(instr.type() == InstructionType::RangeWrite);
         const auto last_reg = static_cast<IRReg>(instr.used_regs()[0]);
 
-        const auto index_pointer = RegisterPointer{ false, this->alloc_temp_for_reg(last_reg) };
+        const auto index_pointer = RegisterPointer{ false, this->alloc_temp_for_reg(IRReg::IN) };
+        const auto address_pointer = RegisterPointer{ true, this->new_temp() };
+
+        this->emit_instruction(
+            { .code = IROpcode::RecordCodeWrite,
+              .vx = index_pointer,
+              .immediate = static_cast<uint32_t>(last_reg) + 1 }
+        );
 
-        for (int i = 0; i < static_cast<int>(last_reg); ++i) {
+        for (int i = 0; i <= static_cast<int>(last_reg); ++i) {
             const auto vn_pointer = RegisterPointer{ false, this->alloc_temp_for_reg(static_cast<IRReg>(i)) };
             this->emit_instruction(
                 { .code = IROpcode::WriteToMemory,
                   .vx = index_pointer,
                   .vy = vn_pointer,
-                  .immediate = static_cast<uint32_t>(i) }
+                  .immediate = static_cast<uint32_t>(i),
+                  .extra_consumed_registers = { std::pair{ address_pointer, RegisterAccessInfo::VYWrite } } }
             );
         }
 
         this->emit_instruction(
-            { .code = IROpcode::AddImm, .vx = index_pointer, .immediate = static_cast<uint32_t>(last_reg) + 1 }
+            { .code = IROpcode::AddImm,
+              .vx = index_pointer,
+              .vy = index_pointer,
+              .immediate = static_cast<uint32_t>(last_reg) + 1 }
         );
+        this->emit_instruction({ .code = IROpcode::ExitIfCodeWritten, .immediate = current_ip + 2u });
     }
 
-    void IRManager::emit_bcd(const Instruction instr) {
+    void IRManager::emit_bcd(const Instruction instr, const uint16_t current_ip) {
         assert(instr.type() == InstructionType::BCD);
         const auto target_reg = static_cast<IRReg>(instr.used_regs()[0]);
         const auto target_copy_reg = this->new_temp();
@@ -540,7 +830,9 @@ namespace jip {
         const auto target_copy_pointer = RegisterPointer{ true, target_copy_reg };
         const auto mod_result_pointer = RegisterPointer{ true, mod_result_reg };
         const auto mod_scratch_pointer = RegisterPointer{ true, this->new_temp() };
+        const auto address_pointer = RegisterPointer{ true, this->new_temp() };
 
+        this->emit_instruction({ .code = IROpcode::RecordCodeWrite, .vx = index_pointer, .immediate = 3 });
         this->emit_instruction({ IROpcode::LoadReg, target_pointer, target_copy_pointer });
         for (int i = 2; i >= 0; --i) {
             this->emit_instruction(
@@ -551,10 +843,15 @@ namespace jip {
                   .extra_consumed_registers = { std::pair{ mod_scratch_pointer, RegisterAccessInfo::VYWrite } } }
             );
             this->emit_instruction(
-                { IROpcode::WriteToMemory, index_pointer, mod_result_pointer, static_cast<uint32_t>(i) }
+                { .code = IROpcode::WriteToMemory,
+                  .vx = index_pointer,
+                  .vy = mod_result_pointer,
+                  .immediate = static_cast<uint32_t>(i),
+                  .extra_consumed_registers = { std::pair{ address_pointer, RegisterAccessInfo::VYWrite } } }
             );
             this->emit_instruction({ IROpcode::DivImm, target_copy_pointer, target_copy_pointer, 10 });
         }
+        this->emit_instruction({ .code = IROpcode::ExitIfCodeWritten, .immediate = current_ip + 2u });
     }
 
     IRManager::BlockHandle IRManager::new_block() noexcept {
@@ -582,11 +879,16 @@ namespace jip {
         case IROpcode::FlagRegisterCheck:
         case IROpcode::LoadImmediate:
         case IROpcode::ReadStackOffset:
+        case IROpcode::ReadTimer:
             return RegisterAccessInfo::VXWrite;
         case IROpcode::JumpToStackWithOffsetAndDecrement:
             return RegisterAccessInfo::VXWrite | RegisterAccessInfo::VXRead | RegisterAccessInfo::VYWrite;
         case IROpcode::ClearDisplayMemory:
         case IROpcode::JmpBlock:
+        case IROpcode::LoopPreheader:
+        case IROpcode::LoopBackEdge:
+        case IROpcode::IdleWait:
+        case IROpcode::ExitIfCodeWritten:
             return RegisterAccessInfo::None;
         case IROpcode::AddImm:
         case IROpcode::SubImm:
@@ -603,8 +905,13 @@ namespace jip {
         case IROpcode::JmpNZ:
         case IROpcode::JmpEqImm:
         case IROpcode::JmpNeImm:
+        case IROpcode::JmpDynamic:
         case IROpcode::WriteStackOffset:
         case IROpcode::WriteToStackWithOffset:
+        case IROpcode::RecordCodeWrite:
+        case IROpcode::JmpKeyDown:
+        case IROpcode::JmpKeyUp:
+        case IROpcode::WriteTimer:
             return RegisterAccessInfo::VXRead;
         case IROpcode::Add:
         case IROpcode::Sub:
@@ -614,11 +921,13 @@ namespace jip {
         case IROpcode::XorRegReg:
         case IROpcode::ShrOne:
         case IROpcode::ShlOne:
+        case IROpcode::AddIndexReg:
             return RegisterAccessInfo::VXRead | RegisterAccessInfo::VXWrite | RegisterAccessInfo::VYRead;
         case IROpcode::XorDisplayMemory:
         case IROpcode::JmpEqReg:
         case IROpcode::JmpNeReg:
         case IROpcode::WriteToMemory:
+        case IROpcode::RecordLazyFlag:
             return RegisterAccessInfo::VXRead | RegisterAccessInfo::VYRead;
         default:
             throw std::logic_error("Unhandled instruction Info");
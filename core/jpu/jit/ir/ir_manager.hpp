@@ -17,6 +17,7 @@ namespace jip {
         DivImm,
         ModImm,
         AndImm,
+        AddIndexReg, // IN += VY, VY zero extended through the scratch in extra_consumed_registers
         LoadImmediate,
         LoadByteFromI,
         LoadReg,
@@ -26,12 +27,21 @@ namespace jip {
         JmpNeImm,
         JmpEqReg,
         JmpNeReg,
+        JmpKeyDown, // Taken if the key VX names is held, through the scratch in extra_consumed_registers
+        JmpKeyUp,
         XorDisplayMemory,
         ClearDisplayMemory,
         ShrImm,
         JmpBlock,
         JmpJit,
+        JmpDynamic,
+        LoopPreheader,
+        LoopBackEdge,
+        IdleWait,
         FlagRegisterCheck,
+        // Stores VX and VY, or VX and immediate_2 without a VY, as the LazyFlag in immediate. Always directly precedes
+        // the operation VF gets computed from, so the operands are read before it overwrites either
+        RecordLazyFlag,
 
         OrRegReg,
         AndRegReg,
@@ -49,6 +59,10 @@ namespace jip {
 
         WriteToMemory,
         ReadFromMemory,
+        ReadTimer,  // VX = the timer at CoreState offset immediate
+        WriteTimer, // The timer at CoreState offset immediate = VX
+        RecordCodeWrite,
+        ExitIfCodeWritten,
 
         Unknown,
     };
@@ -112,10 +126,21 @@ namespace jip {
 
         static RegisterAccessInfo access_info(const IRInstruction& code);
 
+        // Whether `emit` has a lowering for the instruction, anything else has to be left to the interpreter
+        [[nodiscard]] static bool can_lower(const Instruction& instr) noexcept;
+
         uint32_t alloc_temp_for_reg(IRReg reg) noexcept;
 
         void emit(Instruction instr, uint16_t current_ip);
 
+        // The first instruction `emit` had no lowering for, the IR mustn't be compiled if there was one
+        [[nodiscard]] std::optional<InstructionType> unlowered() const noexcept { return this->m_unlowered; }
+
+        // Terminates the block with an exit to `next_ip` unless the last emitted instruction already left the block
+        void close_block(uint16_t next_ip);
+
+        [[nodiscard]] static bool is_terminator(IROpcode code) noexcept;
+
         [[nodiscard]] const auto& blocks() const noexcept { return this->m_blocks; }
 
         [[nodiscard]] const auto& reg_temps() const noexcept { return this->m_register_temps; }
@@ -124,12 +149,16 @@ namespace jip {
 
         void init_jump_points(const auto& jump_points) noexcept { this->m_new_block_points = jump_points; }
 
+        void init_loop_headers(const auto& loop_headers) noexcept { this->m_loop_headers = loop_headers; }
+
         class IRBlock {
         public:
             void emit_instruction(IRInstruction instr) noexcept { this->m_instructions.emplace_back(instr); }
 
             [[nodiscard]] const auto& instructions() const noexcept { return this->m_instructions; }
 
+            [[nodiscard]] auto& instructions() noexcept { return this->m_instructions; }
+
             explicit IRBlock(const uint16_t block_id) noexcept : m_block_id(block_id) {}
 
             [[nodiscard]] uint16_t block_id() const noexcept { return this->m_block_id; }
@@ -148,12 +177,18 @@ namespace jip {
         void emit_jump(Instruction instr);
         void emit_self_jump(Instruction instr);
         void emit_jit_jump(Instruction instr);
+        void emit_long_jump(Instruction instr);
         void emit_skip_reg_eq_imm(Instruction instr);
         void emit_skip_reg_ne_imm(Instruction instr);
         void emit_skip_reg_eq_reg(Instruction instr);
         void emit_skip_reg_ne_reg(Instruction instr);
+        void emit_skip_key(Instruction instr);
+        void emit_read_timer(Instruction instr);
+        void emit_write_timer(Instruction instr);
         void emit_call(Instruction instr, uint16_t current_ip);
         void emit_return(Instruction instr);
+        void emit_inlined_return(Instruction instr);
+        void emit_skip_exit(Instruction instr);
         void emit_mov_reg(Instruction instr);
         void emit_reg_or(Instruction instr);
         void emit_reg_and(Instruction instr);
@@ -163,9 +198,10 @@ namespace jip {
         void emit_reg_sub_yx(Instruction instr);
         void emit_reg_shr_xy(Instruction instr);
         void emit_reg_shl_xy(Instruction instr);
+        void emit_index_add_reg(Instruction instr);
         void emit_range_read(Instruction instr);
-        void emit_range_write(Instruction instr);
-        void emit_bcd(Instruction instr);
+        void emit_range_write(Instruction instr, uint16_t current_ip);
+        void emit_bcd(Instruction instr, uint16_t current_ip);
 
         class BlockHandle {
         public:
@@ -193,6 +229,8 @@ namespace jip {
 
         void emit_instruction(const IRInstruction& instr) noexcept;
 
+        friend class IROptimizer;
+
     private:
         uint32_t m_temp_id{ 0 };
         uint32_t m_label_id{ 0 };
@@ -204,7 +242,14 @@ namespace jip {
         std::vector<uint32_t> m_new_block_points{};
         std::unordered_map<uint32_t, uint32_t> m_block_point_to_block_index{};
 
+        std::vector<uint32_t> m_loop_headers{};
+        // Headers which got a preheader, by ip, with their block and how many instructions were emitted before them
+        std::unordered_map<uint32_t, std::pair<uint32_t, uint32_t>> m_loop_header_blocks{};
+        uint32_t m_emitted_instructions{ 0 };
+
         uint32_t m_block_switch_counter{ 0 };
+        BlockHandle m_skipped_handle{};
         BlockHandle m_handle_to_switch{};
+        std::optional<InstructionType> m_unlowered{};
     };
 } // namespace jip
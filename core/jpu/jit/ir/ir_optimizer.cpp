@@ -0,0 +1,592 @@
+#include "ir_optimizer.hpp"
+
+#include "util/enum.hpp"
+
+#include <algorithm>
+#include <ranges>
+#include <unordered_set>
+
+namespace jip {
+    void IROptimizer::optimize() {
+        this->fold_constants();
+        this->propagate_copies();
+        // Folding drops branches and turns flag checks into loads, both of which leave less VF live
+        this->eliminate_dead_flags();
+    }
+
+    void IROptimizer::fold_constants() {
+        const ControlFlowGraph graph{ *this->m_manager };
+        const SsaForm ssa{ *this->m_manager, graph };
+        const auto constants = this->constant_values(graph, ssa);
+        const auto register_count = static_cast<uint32_t>(this->m_manager->temps().size());
+
+        for (auto&& [index, block] : this->m_manager->m_blocks | std::views::enumerate) {
+            // Folding only ever drops paths, so whatever held on every path into the block before still does
+            KnownValues known{};
+            for (uint32_t reg = 0; reg < register_count; reg++) {
+                const auto value = ssa.entry_value(static_cast<uint16_t>(index), reg);
+                if (value != SsaForm::NoValue && constants[value].has_value()) {
+                    known[reg] = *constants[value];
+                }
+            }
+
+            auto& instructions = block.instructions();
+
+            for (size_t i = 0; i < instructions.size();) {
+                auto& instruction = instructions[i];
+
+                if (const auto taken = branch_outcome(instruction, known); taken.has_value()) {
+                    if (!*taken) {
+                        instructions.erase(instructions.begin() + static_cast<ptrdiff_t>(i));
+                        continue;
+                    }
+
+                    const auto target = ControlFlowGraph::branch_target(instruction);
+                    instruction = { .code = IROpcode::JmpBlock, .immediate = target };
+
+                    // Nothing after an unconditional jump runs, but a loop's preheader has to stay where the register
+                    // allocator expects it
+                    const auto tail = instructions.begin() + static_cast<ptrdiff_t>(i) + 1;
+                    if (std::none_of(tail, instructions.end(), [](const IRInstruction& dead) {
+                            return dead.code == IROpcode::LoopPreheader;
+                        })) {
+                        instructions.erase(tail, instructions.end());
+                    }
+                    break;
+                }
+
+                // IN plus a known register is an immediate add, which doesn't need the scratch either
+                if (instruction.code == IROpcode::AddIndexReg) {
+                    if (const auto it = known.find(instruction.vy->reg); it != known.end()) {
+                        instruction = { IROpcode::AddImm, instruction.vx, instruction.vx, it->second };
+                    }
+                }
+
+                const auto folded = this->fold(instruction, known);
+                if (!folded.has_value()) {
+                    forget_writes(instruction, known);
+                    i++;
+                    continue;
+                }
+
+                const auto dst = destination(instruction);
+                const auto value = folded->value & this->width_mask(dst);
+                instruction = { .code = IROpcode::LoadImmediate, .vx = dst, .immediate = value };
+                known[dst.reg] = value;
+                i++;
+
+                // The host flags the check would have read are never set now, so VF is loaded like the result
+                if (folded->flag.has_value() && i < instructions.size() &&
+                    instructions[i].code == IROpcode::FlagRegisterCheck) {
+                    auto& check = instructions[i];
+                    check = { .code = IROpcode::LoadImmediate, .vx = check.vx, .immediate = *folded->flag };
+                    known[check.vx->reg] = *folded->flag;
+                    i++;
+                }
+            }
+        }
+    }
+
+    std::vector<std::optional<uint32_t>>
+    IROptimizer::constant_values(const ControlFlowGraph& graph, const SsaForm& ssa) const {
+        enum class State : uint8_t {
+            Unknown, // Nothing defining it has been seen to run yet
+            Constant,
+            Varying,
+        };
+
+        struct Cell {
+            State state{ State::Unknown };
+            uint32_t value{};
+        };
+
+        const auto values = ssa.values();
+        std::vector<Cell> cells(values.size());
+        for (auto&& [definition, cell] : std::views::zip(values, cells)) {
+            if (definition.kind == SsaForm::DefinitionKind::Entry) {
+                cell.state = State::Varying;
+            }
+        }
+
+        // Cells only ever go from Unknown to Constant to Varying, so this always settles
+        for (auto changed = true; changed;) {
+            changed = false;
+            const auto update = [&cells, &changed](const SsaForm::Value value, const Cell cell) {
+                auto& current = cells[value];
+                if (current.state != cell.state || current.value != cell.value) {
+                    current = cell;
+                    changed = true;
+                }
+            };
+
+            for (const auto block : graph.reverse_postorder()) {
+                for (const auto& phi : ssa.phis(block)) {
+                    Cell merged{};
+                    for (const auto operand : phi.operands) {
+                        if (operand == SsaForm::NoValue || cells[operand].state == State::Unknown) {
+                            continue;
+                        }
+
+                        const auto& incoming = cells[operand];
+                        if (merged.state == State::Unknown) {
+                            merged = incoming;
+                        } else if (incoming.state == State::Varying || incoming.value != merged.value) {
+                            merged.state = State::Varying;
+                        }
+                    }
+
+                    if (merged.state != State::Unknown) {
+                        update(phi.value, merged);
+                    }
+                }
+
+                const auto& instructions = this->m_manager->m_blocks[block].instructions();
+                for (size_t i = 0; i < instructions.size(); i++) {
+                    const auto operands = ssa.operands(block, static_cast<uint32_t>(i));
+                    KnownValues known{};
+                    auto state = State::Constant;
+
+                    for (const auto& operand : operands) {
+                        if (operand.use == SsaForm::NoValue) {
+                            continue;
+                        }
+
+                        const auto& cell = cells[operand.use];
+                        if (cell.state == State::Varying) {
+                            state = State::Varying;
+                        } else if (cell.state == State::Unknown && state == State::Constant) {
+                            state = State::Unknown;
+                        } else {
+                            known[values[operand.use].reg] = cell.value;
+                        }
+                    }
+
+                    if (state == State::Unknown) {
+                        continue;
+                    }
+
+                    const auto folded = state == State::Constant ? this->fold(instructions[i], known) : std::nullopt;
+                    const auto dst = folded.has_value() ? std::optional{ destination(instructions[i]) } : std::nullopt;
+                    for (const auto& operand : operands) {
+                        if (operand.def == SsaForm::NoValue) {
+                            continue;
+                        }
+
+                        if (dst.has_value() && dst->reg == values[operand.def].reg) {
+                            update(operand.def, { State::Constant, folded->value & this->width_mask(*dst) });
+                        } else {
+                            update(operand.def, { State::Varying });
+                        }
+                    }
+                }
+            }
+        }
+
+        std::vector<std::optional<uint32_t>> constants(values.size());
+        for (auto&& [cell, constant] : std::views::zip(cells, constants)) {
+            if (cell.state == State::Constant) {
+                constant = cell.value;
+            }
+        }
+
+        return constants;
+    }
+
+    void IROptimizer::propagate_copies() {
+        for (auto& block : this->m_manager->m_blocks) {
+            // Any block can be jumped to, so no copy is known to still hold on entry
+            std::unordered_map<uint32_t, RegisterPointer> copies{}; // Copy to the register it was copied from
+
+            for (auto& instruction : block.instructions()) {
+                if (!instruction.vx.has_value() && !instruction.vy.has_value()) {
+                    continue;
+                }
+
+                const auto access = IRManager::access_info(instruction);
+                const auto has = [access](const RegisterAccessInfo flag) { return (access & flag) == flag; };
+                const auto rename = [&copies](std::optional<RegisterPointer>& pointer) {
+                    if (const auto it = copies.find(pointer->reg); it != copies.end()) {
+                        pointer = it->second;
+                    }
+                };
+
+                // Operands that are written as well have to stay what they are
+                if (instruction.vx.has_value() && has(RegisterAccessInfo::VXRead) &&
+                    !has(RegisterAccessInfo::VXWrite)) {
+                    rename(instruction.vx);
+                }
+                if (instruction.vy.has_value() && has(RegisterAccessInfo::VYRead) &&
+                    !has(RegisterAccessInfo::VYWrite)) {
+                    rename(instruction.vy);
+                }
+
+                for (const auto written : written_registers(instruction)) {
+                    std::erase_if(copies, [written](const auto& copy) {
+                        return copy.first == written || copy.second.reg == written;
+                    });
+                }
+
+                if (instruction.code == IROpcode::LoadReg && instruction.vx->reg != instruction.vy->reg) {
+                    copies[instruction.vy->reg] = *instruction.vx;
+                }
+            }
+        }
+
+        // Temps never outlive the compiled code, so one nothing reads after its reads were moved needs no copy at all
+        std::unordered_set<uint32_t> read_temps{};
+        for (const auto& block : this->m_manager->m_blocks) {
+            for (const auto& instruction : block.instructions()) {
+                if (!instruction.vx.has_value() && !instruction.vy.has_value()) {
+                    continue;
+                }
+
+                const auto access = IRManager::access_info(instruction);
+                const auto has = [access](const RegisterAccessInfo flag) { return (access & flag) == flag; };
+                if (instruction.vx.has_value() && instruction.vx->is_temp && has(RegisterAccessInfo::VXRead)) {
+                    read_temps.insert(instruction.vx->reg);
+                }
+                if (instruction.vy.has_value() && instruction.vy->is_temp && has(RegisterAccessInfo::VYRead)) {
+                    read_temps.insert(instruction.vy->reg);
+                }
+                for (const auto& [reg, extra_access] : instruction.extra_consumed_registers) {
+                    if (reg.is_temp && (extra_access & RegisterAccessInfo::VYRead) == RegisterAccessInfo::VYRead) {
+                        read_temps.insert(reg.reg);
+                    }
+                }
+            }
+        }
+
+        for (auto& block : this->m_manager->m_blocks) {
+            std::erase_if(block.instructions(), [&read_temps](const IRInstruction& instruction) {
+                return instruction.code == IROpcode::LoadReg && instruction.vy->is_temp &&
+                       !read_temps.contains(instruction.vy->reg);
+            });
+        }
+    }
+
+    void IROptimizer::eliminate_dead_flags() {
+        const auto vf = this->flag_register();
+        if (!vf.has_value()) {
+            return;
+        }
+
+        auto& blocks = this->m_manager->m_blocks;
+        const ControlFlowGraph graph{ *this->m_manager };
+        const auto live_in = flag_liveness(blocks, graph, *vf, true);
+
+        for (size_t index = 0; index < blocks.size(); index++) {
+            std::vector<size_t> dead_checks{};
+            flag_live_in(blocks, graph, index, *vf, live_in, true, &dead_checks);
+
+            auto& instructions = blocks[index].instructions();
+            for (const auto i : dead_checks) {
+                instructions.erase(instructions.begin() + static_cast<ptrdiff_t>(i));
+            }
+        }
+    }
+
+    void IROptimizer::make_flags_lazy() {
+        const auto vf = this->flag_register();
+        if (!vf.has_value()) {
+            return;
+        }
+
+        // Whatever runs after the compiled code resolves VF itself if it needs it, so only reads within count
+        auto& blocks = this->m_manager->m_blocks;
+        const ControlFlowGraph graph{ *this->m_manager };
+        const auto live_in = flag_liveness(blocks, graph, *vf, false);
+
+        for (size_t index = 0; index < blocks.size(); index++) {
+            std::vector<size_t> dead_checks{};
+            flag_live_in(blocks, graph, index, *vf, live_in, false, &dead_checks);
+
+            auto& instructions = blocks[index].instructions();
+            for (const auto i : dead_checks) {
+                if (i == 0) {
+                    continue;
+                }
+
+                const auto record = lazy_record(instructions[i - 1]);
+                if (!record.has_value()) {
+                    continue;
+                }
+
+                instructions.erase(instructions.begin() + static_cast<ptrdiff_t>(i));
+                instructions.insert(instructions.begin() + static_cast<ptrdiff_t>(i - 1), *record);
+            }
+        }
+    }
+
+    std::optional<uint32_t> IROptimizer::flag_register() const noexcept {
+        const auto& reg_temps = this->m_manager->reg_temps();
+        const auto vf = std::ranges::find(reg_temps, IRReg::VF, &std::pair<uint32_t, IRReg>::second);
+        return vf == reg_temps.end() ? std::nullopt : std::optional{ vf->first };
+    }
+
+    std::vector<bool> IROptimizer::flag_liveness(
+        const std::vector<IRManager::IRBlock>& blocks, const ControlFlowGraph& graph, const uint32_t vf_reg,
+        const bool exits_read
+    ) {
+        std::vector<bool> live_in(blocks.size(), false);
+
+        // Back edges make blocks depend on the ones after them, so this runs until nothing changes. Liveness only ever
+        // grows, so it always settles
+        for (auto changed = true; changed;) {
+            changed = false;
+            for (size_t index = blocks.size(); index-- > 0;) {
+                const auto live = flag_live_in(blocks, graph, index, vf_reg, live_in, exits_read, nullptr);
+                if (live != live_in[index]) {
+                    live_in[index] = live;
+                    changed = true;
+                }
+            }
+        }
+
+        return live_in;
+    }
+
+    bool IROptimizer::flag_live_in(
+        const std::vector<IRManager::IRBlock>& blocks, const ControlFlowGraph& graph, const size_t index,
+        const uint32_t vf_reg, const std::vector<bool>& live_in, const bool exits_read, std::vector<size_t>* dead_checks
+    ) {
+        const auto& instructions = blocks[index].instructions();
+        const auto block = static_cast<uint16_t>(index);
+
+        // Whether anything reads VF once control leaves the block after the instruction at `position`
+        const auto live_after = [&](const uint32_t position) {
+            const auto successor_reads = std::ranges::any_of(graph.successors(block), [&](const auto& edge) {
+                return edge.position == position && live_in[edge.to];
+            });
+            return successor_reads || (exits_read && std::ranges::contains(graph.exits(block), position));
+        };
+
+        auto live = live_after(static_cast<uint32_t>(instructions.size()));
+
+        for (size_t i = instructions.size(); i-- > 0;) {
+            const auto& instruction = instructions[i];
+            live = live || live_after(static_cast<uint32_t>(i));
+
+            if (instruction.code == IROpcode::FlagRegisterCheck && instruction.vx->reg == vf_reg) {
+                if (!live && dead_checks != nullptr) {
+                    dead_checks->push_back(i);
+                }
+                live = false;
+                continue;
+            }
+
+            const auto [reads, writes] = register_access(instruction, vf_reg);
+            live = reads || (live && !writes);
+        }
+
+        return live;
+    }
+
+    std::optional<IRInstruction> IROptimizer::lazy_record(const IRInstruction& operation) noexcept {
+        const auto record = [](const RegisterPointer a, const std::optional<RegisterPointer> b, const LazyFlag kind,
+                               const uint32_t constant = 0) {
+            return IRInstruction{ .code = IROpcode::RecordLazyFlag,
+                                  .vx = a,
+                                  .vy = b,
+                                  .immediate = std::to_underlying(kind),
+                                  .immediate_2 = constant };
+        };
+
+        switch (operation.code) {
+        case IROpcode::Add:
+            return record(*operation.vx, operation.vy, LazyFlag::Carry);
+        case IROpcode::SubInverse: // VX - VY
+            return record(*operation.vx, operation.vy, LazyFlag::NoBorrow);
+        case IROpcode::Sub: // VY - VX
+            return record(*operation.vy, operation.vx, LazyFlag::NoBorrow);
+        case IROpcode::ShrOne:
+            return record(*operation.vy, std::nullopt, LazyFlag::Bit, 0);
+        case IROpcode::ShlOne:
+            return record(*operation.vy, std::nullopt, LazyFlag::Bit, 7);
+        default:
+            return std::nullopt;
+        }
+    }
+
+    std::optional<IROptimizer::Folded>
+    IROptimizer::fold(const IRInstruction& instruction, const KnownValues& known) const noexcept {
+        const auto value_of = [&known](const std::optional<RegisterPointer>& pointer) -> std::optional<uint32_t> {
+            if (!pointer.has_value()) {
+                return std::nullopt;
+            }
+
+            const auto it = known.find(pointer->reg);
+            return it == known.end() ? std::nullopt : std::optional{ it->second };
+        };
+
+        const auto x = value_of(instruction.vx);
+        const auto y = value_of(instruction.vy);
+        const auto imm = instruction.immediate;
+
+        switch (instruction.code) {
+        case IROpcode::LoadImmediate:
+            return Folded{ imm };
+        case IROpcode::LoadReg:
+            return x.has_value() ? std::optional{ Folded{ *x } } : std::nullopt;
+        case IROpcode::AddImm:
+            return x.has_value() ? std::optional{ Folded{ *x + imm } } : std::nullopt;
+        case IROpcode::SubImm:
+            return x.has_value() ? std::optional{ Folded{ *x - imm } } : std::nullopt;
+        case IROpcode::MulImm:
+            return x.has_value() ? std::optional{ Folded{ *x * imm } } : std::nullopt;
+        case IROpcode::DivImm:
+            return x.has_value() && imm != 0 ? std::optional{ Folded{ *x / imm } } : std::nullopt;
+        case IROpcode::ModImm:
+            return x.has_value() && imm != 0 ? std::optional{ Folded{ *x % imm } } : std::nullopt;
+        case IROpcode::ShrImm:
+            return x.has_value() ? std::optional{ Folded{ *x >> imm } } : std::nullopt;
+        case IROpcode::AndImm:
+            return x.has_value() ? std::optional{ Folded{ *x & imm } } : std::nullopt;
+        default:
+            break;
+        }
+
+        // Flags follow what the host instructions BlockCompiler picks would leave in the carry
+        switch (instruction.code) {
+        case IROpcode::ShrOne:
+            return y.has_value() ? std::optional{ Folded{ *y >> 1, *y & 1 } } : std::nullopt;
+        case IROpcode::ShlOne:
+            return y.has_value() ? std::optional{ Folded{ *y << 1, (*y >> 7) & 1 } } : std::nullopt;
+        default:
+            break;
+        }
+
+        if (!x.has_value() || !y.has_value()) {
+            return std::nullopt;
+        }
+
+        switch (instruction.code) {
+        case IROpcode::Add:
+            return Folded{ *x + *y, *x + *y > 0xFF ? 1u : 0u };
+        case IROpcode::Sub:
+            return Folded{ *y - *x, *y >= *x ? 1u : 0u };
+        case IROpcode::SubInverse:
+            return Folded{ *x - *y, *x >= *y ? 1u : 0u };
+        case IROpcode::OrRegReg:
+            return Folded{ *x | *y };
+        case IROpcode::AndRegReg:
+            return Folded{ *x & *y };
+        case IROpcode::XorRegReg:
+            return Folded{ *x ^ *y };
+        case IROpcode::AddIndexReg:
+            return Folded{ *x + *y };
+        default:
+            return std::nullopt;
+        }
+    }
+
+    std::optional<bool>
+    IROptimizer::branch_outcome(const IRInstruction& instruction, const KnownValues& known) noexcept {
+        const auto value_of = [&known](const std::optional<RegisterPointer>& pointer) -> std::optional<uint32_t> {
+            const auto it = known.find(pointer->reg);
+            return it == known.end() ? std::nullopt : std::optional{ it->second };
+        };
+
+        switch (instruction.code) {
+        case IROpcode::JmpZ:
+        case IROpcode::JmpNZ: {
+            const auto x = value_of(instruction.vx);
+            if (!x.has_value()) {
+                return std::nullopt;
+            }
+            return (*x == 0) == (instruction.code == IROpcode::JmpZ);
+        }
+        case IROpcode::JmpEqImm:
+        case IROpcode::JmpNeImm: {
+            const auto x = value_of(instruction.vx);
+            if (!x.has_value()) {
+                return std::nullopt;
+            }
+            return (*x == instruction.immediate) == (instruction.code == IROpcode::JmpEqImm);
+        }
+        case IROpcode::JmpEqReg:
+        case IROpcode::JmpNeReg: {
+            // A register always equals itself, whatever it holds
+            const auto x = value_of(instruction.vx);
+            const auto y = value_of(instruction.vy);
+            const auto same = instruction.vx->reg == instruction.vy->reg;
+            if (!same && (!x.has_value() || !y.has_value())) {
+                return std::nullopt;
+            }
+            return (same || *x == *y) == (instruction.code == IROpcode::JmpEqReg);
+        }
+        default:
+            return std::nullopt;
+        }
+    }
+
+    std::pair<bool, bool> IROptimizer::register_access(const IRInstruction& instruction, const uint32_t reg) {
+        if (!instruction.vx.has_value() && !instruction.vy.has_value()) {
+            return { false, false };
+        }
+
+        const auto access = IRManager::access_info(instruction);
+        const auto has = [access](const RegisterAccessInfo flag) { return (access & flag) == flag; };
+        auto reads = false;
+        auto writes = false;
+
+        if (instruction.vx.has_value() && instruction.vx->reg == reg) {
+            reads |= has(RegisterAccessInfo::VXRead);
+            writes |= has(RegisterAccessInfo::VXWrite);
+        }
+
+        if (instruction.vy.has_value() && instruction.vy->reg == reg) {
+            reads |= has(RegisterAccessInfo::VYRead);
+            writes |= has(RegisterAccessInfo::VYWrite);
+        }
+
+        return { reads, writes };
+    }
+
+    RegisterPointer IROptimizer::destination(const IRInstruction& instruction) noexcept {
+        const auto access = IRManager::access_info(instruction);
+        return (access & RegisterAccessInfo::VXWrite) == RegisterAccessInfo::VXWrite ? *instruction.vx
+                                                                                       : *instruction.vy;
+    }
+
+    uint32_t IROptimizer::width_mask(const RegisterPointer pointer) const noexcept {
+        if (!pointer.is_temp) {
+            for (const auto& [index, reg] : this->m_manager->reg_temps()) {
+                if (index == pointer.reg && reg == IRReg::IN) {
+                    return 0xFFFF;
+                }
+            }
+        }
+
+        return 0xFF;
+    }
+
+    void IROptimizer::forget_writes(const IRInstruction& instruction, KnownValues& known) {
+        for (const auto written : written_registers(instruction)) {
+            known.erase(written);
+        }
+    }
+
+    std::vector<uint32_t> IROptimizer::written_registers(const IRInstruction& instruction) {
+        std::vector<uint32_t> written{};
+        if (!instruction.vx.has_value() && !instruction.vy.has_value()) {
+            return written;
+        }
+
+        const auto access = IRManager::access_info(instruction);
+        if (instruction.vx.has_value() && (access & RegisterAccessInfo::VXWrite) == RegisterAccessInfo::VXWrite) {
+            written.push_back(instruction.vx->reg);
+        }
+
+        if (instruction.vy.has_value() && (access & RegisterAccessInfo::VYWrite) == RegisterAccessInfo::VYWrite) {
+            written.push_back(instruction.vy->reg);
+        }
+
+        for (const auto& [reg, extra_access] : instruction.extra_consumed_registers) {
+            if ((extra_access & RegisterAccessInfo::VYWrite) == RegisterAccessInfo::VYWrite) {
+                written.push_back(reg.reg);
+            }
+        }
+
+        return written;
+    }
+} // namespace jip
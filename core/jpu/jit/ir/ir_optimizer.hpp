@@ -0,0 +1,97 @@
+#pragma once
+#include "control_flow_graph.hpp"
+#include "ir_manager.hpp"
+#include "ssa_form.hpp"
+
+#include <cstdint>
+#include <optional>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace jip {
+    // Rewrites an IRManager's blocks in place, between emitting them and register allocation. Passes only ever replace
+    // or drop instructions and never renumber blocks, so jump targets and temps stay valid
+    class IROptimizer {
+    public:
+        explicit IROptimizer(IRManager& manager) noexcept : m_manager(&manager) {}
+
+        // Runs every pass that doesn't change what the compiled code leaves behind, in order
+        void optimize();
+
+        // Tracks which guest registers and temps hold a known value within each block, replacing anything computed only
+        // from known values with a LoadImmediate. Branches with a known outcome become a JmpBlock or are dropped. Each
+        // block starts out knowing whatever the SSA form proves holds on every path into it
+        void fold_constants();
+
+        // Points every read of a LoadReg's target at its source instead, for as long as neither is written again within
+        // the block, and drops copies into temps nothing reads any more. What's left of a copy is often dead by the
+        // time it runs, which lets the block compiler store it or rename a host register rather than emit a mov
+        void propagate_copies();
+
+        // Drops every FlagRegisterCheck whose VF is overwritten on every path before anything reads it. Liveness flows
+        // backwards over the control flow graph, anything leaving the compiled code counts as a read
+        void eliminate_dead_flags();
+
+        // Only for lazy flags code, runs after optimize. Every FlagRegisterCheck nothing in the compiled code reads
+        // becomes a RecordLazyFlag ahead of its operation, leaving VF to whoever reads it next
+        void make_flags_lazy();
+
+    private:
+        using KnownValues = std::unordered_map<uint32_t, uint32_t>; // Register or temp to what it holds
+
+        struct Folded {
+            uint32_t value{};
+            std::optional<uint32_t> flag{}; // What VF gets set to, for operations followed by a FlagRegisterCheck
+        };
+
+        // The result of `instruction` if everything it reads is known
+        [[nodiscard]] std::optional<Folded>
+        fold(const IRInstruction& instruction, const KnownValues& known) const noexcept;
+
+        // Whether the branch is taken, if everything it compares is known
+        [[nodiscard]] static std::optional<bool>
+        branch_outcome(const IRInstruction& instruction, const KnownValues& known) noexcept;
+
+        // What each SSA value is known to hold on every path defining it, optimistically assuming loops keep constants
+        // constant until something shows otherwise
+        [[nodiscard]] std::vector<std::optional<uint32_t>>
+        constant_values(const ControlFlowGraph& graph, const SsaForm& ssa) const;
+
+        // Whether `instruction` reads and whether it writes `reg`
+        [[nodiscard]] static std::pair<bool, bool> register_access(const IRInstruction& instruction, uint32_t reg);
+
+        // The register VF was given, if the IR uses it at all
+        [[nodiscard]] std::optional<uint32_t> flag_register() const noexcept;
+
+        // Whether VF is live entering each block. With `exits_read` unset leaving the compiled code doesn't read it
+        [[nodiscard]] static std::vector<bool> flag_liveness(
+            const std::vector<IRManager::IRBlock>& blocks, const ControlFlowGraph& graph, uint32_t vf_reg,
+            bool exits_read
+        );
+
+        // Whether VF is live entering block `index`, given what's known for every block. The dead checks found on the
+        // way are added to `dead_checks`, last first
+        static bool flag_live_in(
+            const std::vector<IRManager::IRBlock>& blocks, const ControlFlowGraph& graph, size_t index, uint32_t vf_reg,
+            const std::vector<bool>& live_in, bool exits_read, std::vector<size_t>* dead_checks
+        );
+
+        // What records the flag `operation` would set, if VF can be computed from its operands later
+        [[nodiscard]] static std::optional<IRInstruction> lazy_record(const IRInstruction& operation) noexcept;
+
+        // The register `instruction` writes its result to
+        [[nodiscard]] static RegisterPointer destination(const IRInstruction& instruction) noexcept;
+
+        // IN is 16 bits wide, everything else 8
+        [[nodiscard]] uint32_t width_mask(RegisterPointer pointer) const noexcept;
+
+        static void forget_writes(const IRInstruction& instruction, KnownValues& known);
+
+        // Everything `instruction` writes, scratch registers included
+        [[nodiscard]] static std::vector<uint32_t> written_registers(const IRInstruction& instruction);
+
+    private:
+        IRManager* m_manager{ nullptr };
+    };
+} // namespace jip
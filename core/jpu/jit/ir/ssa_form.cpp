@@ -0,0 +1,241 @@
+#include "ssa_form.hpp"
+
+#include "util/enum.hpp"
+
+#include <algorithm>
+#include <optional>
+#include <ranges>
+
+namespace jip {
+    struct OperandSlot {
+        std::optional<uint32_t> reg{};
+        bool read{ false };
+        bool write{ false };
+    };
+
+    // In the order SsaForm::Operand documents
+    static std::vector<OperandSlot> operand_slots(const IRInstruction& instruction) {
+        if (!instruction.vx.has_value() && !instruction.vy.has_value()) {
+            return {};
+        }
+
+        const auto access = IRManager::access_info(instruction);
+        const auto has = [](const RegisterAccessInfo info, const RegisterAccessInfo flag) {
+            return (info & flag) == flag;
+        };
+        const auto slot = [](const std::optional<RegisterPointer>& pointer, const bool read, const bool write) {
+            return pointer.has_value() ? OperandSlot{ pointer->reg, read, write } : OperandSlot{};
+        };
+
+        std::vector<OperandSlot> slots{
+            slot(instruction.vx, has(access, RegisterAccessInfo::VXRead), has(access, RegisterAccessInfo::VXWrite)),
+            slot(instruction.vy, has(access, RegisterAccessInfo::VYRead), has(access, RegisterAccessInfo::VYWrite)),
+        };
+        for (const auto& [reg, extra_access] : instruction.extra_consumed_registers) {
+            slots.emplace_back(
+                reg.reg, has(extra_access, RegisterAccessInfo::VYRead), has(extra_access, RegisterAccessInfo::VYWrite)
+            );
+        }
+
+        return slots;
+    }
+
+    // Instructions after a block's first terminator never run
+    static size_t runnable_length(const std::vector<IRInstruction>& instructions) noexcept {
+        const auto terminator = std::ranges::find_if(instructions, [](const IRInstruction& instruction) {
+            return IRManager::is_terminator(instruction.code);
+        });
+
+        return terminator == instructions.end() ? instructions.size()
+                                                : static_cast<size_t>(terminator - instructions.begin()) + 1;
+    }
+
+    SsaForm::SsaForm(const IRManager& manager, const ControlFlowGraph& graph) {
+        const auto& blocks = manager.blocks();
+        this->m_register_count = manager.temps().size();
+        this->m_phis.resize(blocks.size());
+        this->m_operands.resize(blocks.size());
+        this->m_entry_values.resize(blocks.size());
+
+        for (uint32_t reg = 0; reg < this->m_register_count; reg++) {
+            this->define(DefinitionKind::Entry, reg, 0, 0);
+        }
+
+        if (blocks.empty()) {
+            return;
+        }
+
+        this->place_phis(manager, graph);
+
+        std::vector<std::vector<uint16_t>> dominated(blocks.size());
+        for (const auto block : graph.reverse_postorder() | std::views::drop(1)) {
+            dominated[*graph.immediate_dominator(block)].emplace_back(block);
+        }
+
+        std::vector<std::vector<Value>> stacks(this->m_register_count);
+        for (uint32_t reg = 0; reg < this->m_register_count; reg++) {
+            stacks[reg].emplace_back(reg);
+        }
+
+        this->rename(manager, graph, 0, dominated, stacks);
+    }
+
+    SsaForm::Value SsaForm::entry_value(const uint16_t block, const uint32_t reg) const noexcept {
+        const auto& values = this->m_entry_values[block];
+        return values.empty() ? NoValue : values[reg];
+    }
+
+    void SsaForm::place_phis(const IRManager& manager, const ControlFlowGraph& graph) {
+        const auto& blocks = manager.blocks();
+        std::vector<bool> read_across_blocks(this->m_register_count, false);
+        std::vector<std::vector<uint16_t>> defining_blocks(this->m_register_count);
+
+        for (const auto block : graph.reverse_postorder()) {
+            const auto& instructions = blocks[block].instructions();
+            std::vector<bool> written(this->m_register_count, false);
+
+            for (size_t i = 0; i < runnable_length(instructions); i++) {
+                const auto slots = operand_slots(instructions[i]);
+                for (const auto& slot : slots) {
+                    if (slot.reg.has_value() && slot.read && !written[*slot.reg]) {
+                        read_across_blocks[*slot.reg] = true;
+                    }
+                }
+
+                for (const auto& slot : slots) {
+                    if (!slot.reg.has_value() || !slot.write || written[*slot.reg]) {
+                        continue;
+                    }
+                    written[*slot.reg] = true;
+                    defining_blocks[*slot.reg].emplace_back(block);
+                }
+            }
+        }
+
+        for (uint32_t reg = 0; reg < this->m_register_count; reg++) {
+            if (!read_across_blocks[reg]) {
+                continue;
+            }
+
+            std::vector<bool> has_phi(blocks.size(), false);
+            std::vector<bool> defines(blocks.size(), false);
+            for (const auto block : defining_blocks[reg]) {
+                defines[block] = true;
+            }
+
+            auto work = defining_blocks[reg];
+            while (!work.empty()) {
+                const auto block = work.back();
+                work.pop_back();
+
+                for (const auto join : graph.dominance_frontier(block)) {
+                    if (has_phi[join]) {
+                        continue;
+                    }
+                    has_phi[join] = true;
+
+                    // The entry block is also reached from outside, which comes first
+                    const auto from_outside = join == 0 ? 1u : 0u;
+                    auto& phi = this->m_phis[join].emplace_back(
+                        reg,
+                        this->define(DefinitionKind::Phi, reg, join, 0),
+                        std::vector<Value>(graph.predecessors(join).size() + from_outside, NoValue)
+                    );
+                    if (from_outside != 0) {
+                        phi.operands[0] = reg;
+                    }
+
+                    if (!defines[join]) {
+                        defines[join] = true;
+                        work.emplace_back(join);
+                    }
+                }
+            }
+        }
+    }
+
+    void SsaForm::rename(
+        const IRManager& manager, const ControlFlowGraph& graph, const uint16_t block,
+        const std::vector<std::vector<uint16_t>>& dominated, std::vector<std::vector<Value>>& stacks
+    ) {
+        const auto& instructions = manager.blocks()[block].instructions();
+        std::vector<uint32_t> pushed{};
+
+        for (const auto& phi : this->m_phis[block]) {
+            stacks[phi.reg].emplace_back(phi.value);
+            pushed.emplace_back(phi.reg);
+        }
+
+        auto& entry_values = this->m_entry_values[block];
+        entry_values.reserve(this->m_register_count);
+        for (const auto& stack : stacks) {
+            entry_values.emplace_back(stack.back());
+        }
+
+        // Hands whatever is current to the phis of every block entered from `position`
+        const auto leave = [&](const uint32_t position) {
+            for (const auto& edge : graph.successors(block)) {
+                if (edge.position != position) {
+                    continue;
+                }
+
+                const auto predecessors = graph.predecessors(edge.to);
+                const auto from = std::ranges::find_if(predecessors, [&edge](const ControlFlowGraph::Edge& incoming) {
+                    return incoming.from == edge.from && incoming.position == edge.position;
+                });
+                const auto index = static_cast<size_t>(from - predecessors.begin()) + (edge.to == 0 ? 1 : 0);
+
+                for (auto& phi : this->m_phis[edge.to]) {
+                    phi.operands[index] = stacks[phi.reg].back();
+                }
+            }
+        };
+
+        auto& operands = this->m_operands[block];
+        operands.resize(instructions.size());
+        const auto runnable = runnable_length(instructions);
+
+        for (size_t i = 0; i < instructions.size(); i++) {
+            const auto slots = operand_slots(instructions[i]);
+            auto& instruction_operands = operands[i];
+            instruction_operands.resize(slots.size());
+            if (i >= runnable) {
+                continue;
+            }
+
+            // Everything an instruction reads is read before anything it writes is written
+            for (auto&& [slot, operand] : std::views::zip(slots, instruction_operands)) {
+                if (slot.reg.has_value() && slot.read) {
+                    operand.use = stacks[*slot.reg].back();
+                }
+            }
+
+            for (auto&& [slot, operand] : std::views::zip(slots, instruction_operands)) {
+                if (!slot.reg.has_value() || !slot.write) {
+                    continue;
+                }
+
+                operand.def = this->define(DefinitionKind::Instruction, *slot.reg, block, static_cast<uint32_t>(i));
+                stacks[*slot.reg].emplace_back(operand.def);
+                pushed.emplace_back(*slot.reg);
+            }
+
+            leave(static_cast<uint32_t>(i));
+        }
+        leave(static_cast<uint32_t>(instructions.size()));
+
+        for (const auto child : dominated[block]) {
+            this->rename(manager, graph, child, dominated, stacks);
+        }
+
+        for (const auto reg : pushed) {
+            stacks[reg].pop_back();
+        }
+    }
+
+    SsaForm::Value
+    SsaForm::define(const DefinitionKind kind, const uint32_t reg, const uint16_t block, const uint32_t instruction) {
+        this->m_values.emplace_back(kind, reg, block, instruction);
+        return static_cast<Value>(this->m_values.size() - 1);
+    }
+} // namespace jip
@@ -0,0 +1,80 @@
+#pragma once
+#include "control_flow_graph.hpp"
+#include "ir_manager.hpp"
+
+#include <cstdint>
+#include <limits>
+#include <span>
+#include <vector>
+
+namespace jip {
+    // Every register and temp of an IRManager split into values that are each defined exactly once, with phis where
+    // blocks join. The IR itself stays as it is, the register allocator and block compiler keep working on mutable
+    // registers, so this is a view passes build when they need to know which definition a read sees. Phis are only
+    // placed for registers some block reads before writing, nothing else is ever live across a join. Like the graph
+    // it's built from, it's only valid until the blocks change
+    class SsaForm {
+    public:
+        using Value = uint32_t;
+        constexpr static Value NoValue = std::numeric_limits<Value>::max();
+
+        enum class DefinitionKind : uint8_t {
+            Entry,       // Whatever the register held when the compiled code was entered
+            Phi,         // One of `block`'s phis
+            Instruction, // Instruction `instruction` of `block`
+        };
+
+        struct Definition {
+            DefinitionKind kind{ DefinitionKind::Entry };
+            uint32_t reg{};
+            uint16_t block{};
+            uint32_t instruction{};
+        };
+
+        struct Phi {
+            uint32_t reg{};
+            Value value{};
+            // Lined up with the block's predecessors, NoValue for those that are never reached. The entry block is also
+            // entered from outside, its phis take the Entry value for that first
+            std::vector<Value> operands{};
+        };
+
+        // The value an operand reads, and the one it defines. Operands are vx, vy and then the extra consumed
+        // registers, in that order, with NoValue for any that aren't there or aren't read or written
+        struct Operand {
+            Value use{ NoValue };
+            Value def{ NoValue };
+        };
+
+        SsaForm(const IRManager& manager, const ControlFlowGraph& graph);
+
+        // Indexed by value, the first of them are the Entry values of every register in order
+        [[nodiscard]] std::span<const Definition> values() const noexcept { return this->m_values; }
+
+        [[nodiscard]] std::span<const Phi> phis(const uint16_t block) const noexcept { return this->m_phis[block]; }
+
+        [[nodiscard]] std::span<const Operand>
+        operands(const uint16_t block, const uint32_t instruction) const noexcept {
+            return this->m_operands[block][instruction];
+        }
+
+        // Which of `reg`'s values is live entering `block`, after its phis. NoValue for unreachable blocks
+        [[nodiscard]] Value entry_value(uint16_t block, uint32_t reg) const noexcept;
+
+    private:
+        void place_phis(const IRManager& manager, const ControlFlowGraph& graph);
+        void rename(
+            const IRManager& manager, const ControlFlowGraph& graph, uint16_t block,
+            const std::vector<std::vector<uint16_t>>& dominated, std::vector<std::vector<Value>>& stacks
+        );
+
+        Value define(DefinitionKind kind, uint32_t reg, uint16_t block, uint32_t instruction);
+
+    private:
+        size_t m_register_count{ 0 };
+        std::vector<Definition> m_values{};
+        std::vector<std::vector<Phi>> m_phis{};
+        std::vector<std::vector<std::vector<Operand>>> m_operands{}; // Block, instruction, operand
+        std::vector<std::vector<Value>> m_entry_values{};            // Block, register. Empty for unreachable blocks
+    };
+} // namespace jip
@@ -4,10 +4,9 @@
 #include <print>
 
 namespace jip {
-    uint16_t JitBlock::execute() const {
-        using ptr = uint16_t (*)();
-        const auto p = std::bit_cast<ptr>(m_jitted_code);
-        const auto next_location = p();
+    uint16_t JitBlock::execute(void* dispatch_loop, void* entry, CoreState* state) {
+        using ptr = uint16_t (*)(CoreState*, void*);
+        const auto next_location = std::bit_cast<ptr>(dispatch_loop)(state, entry);
         // std::println("Returned from JIT block, jumping to: 0x{:x}", next_location);
         return next_location;
     }
@@ -1,19 +1,67 @@
 #pragma once
+#include "jpu/core.hpp"
+
+#include <cstddef>
 #include <cstdint>
+#include <utility>
+#include <vector>
 
 namespace jip {
     class JitBlock {
     public:
-        explicit JitBlock(void* memory) : m_jitted_code(memory) {}
+        // A constant target exit, ending in a `jmp rel32` which by default falls through into a `ret`. Linking
+        // rewrites the displacement so the exit jumps straight into the successor block instead
+        struct Exit {
+            uint32_t patch_offset{}; // Offset of the rel32 displacement from the start of the block
+            uint16_t target_ip{};
+        };
+
+        // A guest instruction the block was translated from, as it was when it got compiled
+        struct CodeWord {
+            uint16_t address{};
+            uint16_t bytes{};
+        };
+
+        JitBlock(
+            void* memory, const size_t code_size, const uint16_t start_ip, std::vector<Exit> exits,
+            std::vector<CodeWord> code, const bool shared = false
+        )
+            : m_jitted_code(memory), m_code_size(code_size), m_exits(std::move(exits)), m_code(std::move(code)),
+              m_start_ip(start_ip), m_shared(shared) {}
 
         JitBlock(const JitBlock&) = default;
         JitBlock& operator=(const JitBlock&) = default;
         JitBlock(JitBlock&&) = default;
         JitBlock& operator=(JitBlock&&) = default;
 
-        uint16_t execute() const;
+        // Blocks have no frame of their own, so they're only ever entered through a JIT dispatch loop, which runs
+        // `entry` and whatever follows until the dispatcher is needed. Everything they touch is reached through `state`
+        static uint16_t execute(void* dispatch_loop, void* entry, CoreState* state);
+
+        [[nodiscard]] void* entry() const noexcept { return this->m_jitted_code; }
+
+        // Bytes of host code, what the block counts against the JitManager's code cache budget
+        [[nodiscard]] size_t code_size() const noexcept { return this->m_code_size; }
+
+        [[nodiscard]] uint16_t start_ip() const noexcept { return this->m_start_ip; }
+
+        [[nodiscard]] const auto& exits() const noexcept { return this->m_exits; }
+
+        [[nodiscard]] const auto& code() const noexcept { return this->m_code; }
+
+        // Code owned by SharedCode, which the JitManager must never release
+        [[nodiscard]] bool is_shared() const noexcept { return this->m_shared; }
+
+        [[nodiscard]] void* patch_site(const uint32_t exit_index) const noexcept {
+            return static_cast<uint8_t*>(this->m_jitted_code) + this->m_exits[exit_index].patch_offset;
+        }
 
     private:
         void* m_jitted_code{ nullptr };
+        size_t m_code_size{ 0 };
+        std::vector<Exit> m_exits{};
+        std::vector<CodeWord> m_code{};
+        uint16_t m_start_ip{ 0 };
+        bool m_shared{ false };
     };
 } // namespace jip
\ No newline at end of file
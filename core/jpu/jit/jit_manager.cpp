@@ -2,22 +2,72 @@
 
 #include "cpu/chip_core.hpp"
 #include "instruction_list.hpp"
+#include "ir/ir_optimizer.hpp"
 #include "linear_register_allocator.hpp"
 #include "util/division.hpp"
 
 #include <algorithm>
 #include <asmjit/x86.h>
+#include <bit>
+#include <cstring>
 #include <format>
+#include <functional>
+#include <limits>
+#include <numeric>
 
 #include <memory>
 #include <print>
+#include <ranges>
+#include <stdexcept>
 
 namespace jip {
     using namespace asmjit::x86;
     constexpr static auto arg_1 = rdi;
+    constexpr static auto arg_2 = rsi;
 
     static JitManager* raw_instance = nullptr;
 
+    // Keeps every block in an ahead of time image starting on its own fetch window
+    constexpr static size_t ImageBlockAlignment = 16;
+
+    // Every callee saved register but rbp, which holds the state pointer. The rest of the allocator's pool is left for
+    // temporaries and whatever isn't pinned
+    const static auto PinnableRegisters = std::array{ bl, r12b, r13b, r14b, r15b };
+
+    // How often each V register is named by the ROM's instructions, a rough stand in for how hot it is
+    static std::array<uint32_t, GPRegCount> register_references(const std::span<const uint8_t> rom) noexcept {
+        std::array<uint32_t, GPRegCount> references{};
+
+        for (size_t address = 0; address + 1 < rom.size(); address += 2) {
+            const auto instr = static_cast<uint16_t>(rom[address] << 8 | rom[address + 1]);
+            const auto x = (instr & 0xF00) >> 8;
+            const auto y = (instr & 0xF0) >> 4;
+
+            switch (instr >> 12) {
+            case 0x5:
+            case 0x8:
+            case 0x9:
+            case 0xD:
+                references[x]++;
+                references[y]++;
+                break;
+            case 0x3:
+            case 0x4:
+            case 0x6:
+            case 0x7:
+            case 0xC:
+            case 0xE:
+            case 0xF:
+                references[x]++;
+                break;
+            default:
+                break;
+            }
+        }
+
+        return references;
+    }
+
     Gp remap_8_16(const Gp& reg_8) noexcept {
         const static auto register_remapping_8_16 = std::vector<std::pair<Gp, Gp>>{
             { al,   ax   },
@@ -126,54 +176,833 @@ namespace jip {
         std::unreachable();
     }
 
-    JitManager::JitManager() { raw_instance = this; }
+    JitManager::JitManager() {
+        raw_instance = this;
+
+        // Blocks jump into the dispatch table with the stack exactly as they were entered and the target ip in rax,
+        // so a miss only has to return to the dispatcher for the target to be compiled
+        asmjit::CodeHolder code{};
+        code.init(this->m_rt.environment(), this->m_rt.cpu_features());
+        asmjit::x86::Assembler a{ &code };
+        a.ret();
+
+        if (this->m_rt.add(&this->m_miss_stub, &code) != asmjit::Error::kOk) {
+            throw std::runtime_error("Failed to create the dispatch miss stub");
+        }
+
+        this->m_dispatch_table.fill(this->m_miss_stub);
+        this->emit_dispatch_loop();
+        this->emit_resolve_flag_stub();
+        this->m_compile_worker = std::jthread{ [this](const std::stop_token& stop) { this->compile_worker(stop); } };
+    }
+
+    JitManager::~JitManager() {
+        // Anything still being compiled for other instances would otherwise stay in flight for good
+        for (const auto ip : this->m_claimed_blocks) {
+            this->m_shared_code->abandon(ip);
+        }
+    }
+
+    void JitManager::set_state(CoreState* state) noexcept {
+        this->m_core_state = state;
+        state->dispatch_table = this->m_dispatch_table.data();
+        state->miss_stub = this->m_miss_stub;
+        state->resolve_flag_stub = this->m_resolve_flag_stub;
+    }
+
+    std::optional<JitBlock>
+    JitManager::compile_block(const uint16_t current_ip, const std::span<const uint8_t> memory) noexcept {
+        InstructionList chip_instrs{};
+        chip_instrs.create_block(memory, current_ip);
+
+        return this->compile_instructions(chip_instrs, current_ip, memory);
+    }
+
+    std::optional<JitBlock> JitManager::compile_trace(
+        const uint16_t current_ip, const std::span<const uint8_t> memory, const SkipProfile& profile
+    ) noexcept {
+        InstructionList chip_instrs{};
+        chip_instrs.create_trace(memory, current_ip, profile);
+
+        return this->compile_instructions(chip_instrs, current_ip, memory);
+    }
+
+    std::optional<JitBlock> JitManager::compile_instructions(
+        const InstructionList& instructions, const uint16_t current_ip, const std::span<const uint8_t> memory
+    ) noexcept {
+        if (instructions.size() == 0) {
+            return std::nullopt;
+        }
+
+        std::vector<JitBlock::CodeWord> code{};
+        for (const auto& instr : instructions) {
+            const auto address = instr.address();
+            if (!std::ranges::contains(code, address, &JitBlock::CodeWord::address)) {
+                code.emplace_back(address, static_cast<uint16_t>(memory[address] << 8 | memory[address + 1]));
+            }
+        }
+
+        const auto diagnostic = this->m_profile == JitProfile::Diagnostic;
+        auto ir = emit_ir(instructions);
+        if (const auto unlowered = ir->unlowered(); unlowered.has_value()) {
+            if (diagnostic) {
+                std::println(
+                    "No lowering for instruction type {:x}, 0x{:x} stays interpreted",
+                    static_cast<uint32_t>(*unlowered),
+                    current_ip
+                );
+            }
+            return std::nullopt;
+        }
+
+        IROptimizer optimizer{ *ir };
+        optimizer.optimize();
+        if (this->m_lazy_flags) {
+            optimizer.make_flags_lazy();
+        }
+        LinearRegisterAllocator reg_allocator{};
+        reg_allocator.track(*ir);
+
+        const auto compiler = std::make_unique<BlockCompiler>(this, std::move(ir), std::move(reg_allocator));
+        compiler->emit_machine_code(current_ip, static_cast<uint32_t>(instructions.size()));
+        if (const auto unhandled = compiler->unhandled_opcode(); unhandled.has_value()) {
+            if (diagnostic) {
+                std::println(
+                    "No machine code for IR opcode {:x}, 0x{:x} stays interpreted",
+                    static_cast<uint32_t>(*unhandled),
+                    current_ip
+                );
+            }
+            return std::nullopt;
+        }
+
+        return BlockCompiler::as_jit_block(compiler, std::move(code));
+    }
+
+    uint16_t JitManager::execute_for(const uint16_t start_ip, const int32_t budget) noexcept {
+        auto next_address = start_ip;
+        this->m_core_state->cycle_budget = budget;
+        this->m_core_state->wait_event = WaitEvent::None;
+
+        while (this->m_core_state->cycle_budget > 0) {
+            if (this->m_has_compiled_blocks.load(std::memory_order_acquire)) {
+                this->install_compiled_blocks();
+            }
+
+            const auto entry = this->dispatch_entry(next_address);
+
+            // Until the worker hands the block back the guest keeps going in the interpreter
+            if (entry == this->m_miss_stub) {
+                if (this->install_shared_block(next_address) || this->install_cached_block(next_address)) {
+                    continue;
+                }
+
+                if (this->is_hot(next_address) && this->should_compile(next_address)) {
+                    this->queue_compile(next_address);
+                }
+
+                next_address = this->m_interpreter.run_block(*this->m_core_state, next_address);
+            } else {
+                next_address = JitBlock::execute(this->m_dispatch_loop, entry, this->m_core_state);
+            }
+
+            if (this->m_core_state->code_written != 0) {
+                this->invalidate_written_code();
+            }
+        }
+
+        return next_address;
+    }
+
+    JitBlock* JitManager::find_block(const uint16_t ip) noexcept {
+        if ((ip & 1) != 0 || ip >= MemorySize) {
+            const auto it = this->m_unaligned_blocks.find(ip);
+            return it == this->m_unaligned_blocks.end() ? nullptr : &it->second;
+        }
+
+        auto& block = this->m_blocks[ip >> 1];
+        return block.has_value() ? &*block : nullptr;
+    }
+
+    void* JitManager::dispatch_entry(const uint16_t ip) noexcept {
+        if ((ip & 1) != 0 || ip >= MemorySize) {
+            const auto* block = this->find_block(ip);
+            return block == nullptr ? this->m_miss_stub : block->entry();
+        }
+
+        return this->m_dispatch_table[ip >> 1];
+    }
+
+
+    bool JitManager::is_hot(const uint16_t ip) noexcept {
+        // Odd addresses are rare enough that they aren't worth a counter, and nothing past the end of memory has a
+        // slot to compile into, the interpreter just parks there
+        if (ip >= MemorySize) {
+            return false;
+        }
+
+        if (this->m_interpreted_blocks.test(ip)) {
+            return false;
+        }
+
+        if (ip & 1) {
+            return true;
+        }
+
+        return ++this->m_execution_counts[ip >> 1] > this->m_hotness_threshold;
+    }
+
+    void JitManager::queue_compile(const uint16_t ip) {
+        if (!this->m_queued_blocks.insert(ip).second) {
+            return;
+        }
+
+        // The worker gets its own copy so the guest is free to keep writing memory while it compiles
+        const auto& memory = this->m_core_state->memory;
+        {
+            std::scoped_lock lock{ this->m_compile_mutex };
+            this->m_compile_queue.emplace_back(
+                ip, std::vector<uint8_t>{ memory.begin(), memory.end() }, this->m_interpreter.skip_profile()
+            );
+        }
+        this->m_compile_ready.notify_one();
+    }
+
+    void JitManager::install_compiled_blocks() noexcept {
+        std::vector<CompiledBlock> compiled{};
+        {
+            std::scoped_lock lock{ this->m_compile_mutex };
+            compiled.swap(this->m_compiled_blocks);
+            this->m_has_compiled_blocks.store(false, std::memory_order_relaxed);
+        }
+
+        for (auto& [ip, compiled_block] : compiled) {
+            this->m_queued_blocks.erase(ip);
+            const auto claimed = this->m_claimed_blocks.erase(ip) != 0;
+
+            // Nothing the JIT could lower, the interpreter keeps running it and it's never queued again
+            if (!compiled_block.has_value()) {
+                if (claimed) {
+                    this->m_shared_code->abandon(ip);
+                }
+                this->m_interpreted_blocks.set(ip);
+                continue;
+            }
+            auto& block = *compiled_block;
+
+            // Compiled from a snapshot the guest has written over since, it gets another go once it's hot again
+            if (!this->matches_memory(block.code())) {
+                if ((ip & 1) == 0 && ip < MemorySize) {
+                    this->m_execution_counts[ip >> 1] = 0;
+                }
+                if (claimed) {
+                    this->m_shared_code->abandon(ip);
+                }
+                this->m_rt.release(block.entry());
+                continue;
+            }
+
+            if (this->m_code_cache != nullptr) {
+                this->m_code_cache->store(block);
+            }
+
+            // Whatever doesn't get published stays private, which works just as well for this instance
+            if (claimed) {
+                if (const auto* shared = this->m_shared_code->publish(ip, block); shared != nullptr) {
+                    this->m_rt.release(block.entry());
+                    block = JitBlock{ shared->entry, shared->code_size, ip, {}, shared->code, true };
+                }
+            }
+            this->register_block(ip, std::move(block));
+        }
+    }
+
+    void JitManager::share_code(const std::span<const uint8_t> rom) {
+        this->m_shared_code = SharedCode::for_rom(CodeCache::hash_rom(rom) ^ this->m_code_variant);
+    }
+
+    void JitManager::set_profile(const JitProfile profile) {
+        this->m_profile = profile;
+        this->m_code_variant = this->m_code_variant * 31 + static_cast<uint64_t>(profile);
+
+        this->m_rt.release(this->m_dispatch_loop);
+        this->emit_dispatch_loop();
+    }
+
+    void JitManager::set_lazy_flags(const bool enabled) noexcept {
+        this->m_lazy_flags = enabled;
+        this->m_code_variant = this->m_code_variant * 31 + (enabled ? 1 : 0);
+    }
+
+    void JitManager::pin_registers(const std::span<const uint8_t> rom) {
+        auto references = register_references(rom);
+        if (this->m_lazy_flags) {
+            references[0xF] = 0; // Has to stay in the state, where resolving a lazy flag writes it
+        }
+        std::array<uint8_t, GPRegCount> by_use{};
+        std::ranges::iota(by_use, 0);
+        std::ranges::stable_sort(by_use, std::ranges::greater{}, [&references](const uint8_t reg) {
+            return references[reg];
+        });
+
+        this->m_pinned_registers.clear();
+        for (const auto& [guest, host] : std::views::zip(by_use, PinnableRegisters)) {
+            if (references[guest] == 0) {
+                break;
+            }
+
+            this->m_pinned_registers.emplace_back(guest, host);
+            this->m_code_variant = this->m_code_variant * 31 + (guest << 8 | host.id()) + 1;
+        }
+
+        // Nothing has run through the old loop yet, it only has to start loading the pinned registers
+        this->m_rt.release(this->m_dispatch_loop);
+        this->emit_dispatch_loop();
+    }
+
+    void JitManager::emit_dispatch_loop() {
+        asmjit::CodeHolder code{};
+        code.init(this->m_rt.environment(), this->m_rt.cpu_features());
+        asmjit::x86::Assembler a{ &code };
+        const auto enter = a.new_label();
+        const auto next = a.new_label();
+        const auto leave = a.new_label();
+        constexpr auto callee_saved = std::array{ rbx, rbp, r12, r13, r14, r15 };
+        constexpr auto non_table_bits = ~static_cast<uint32_t>(MemorySize - 2);
+
+        // Called as `uint16_t(CoreState*, void* entry)`. Six pushes leave the stack where the call found it, one more
+        // slot puts blocks back at the alignment they'd have when called from C++
+        for (const auto& reg : callee_saved) {
+            a.push(reg);
+        }
+        a.sub(rsp, 8);
+        a.mov(rbp, arg_1);
+        if (this->m_profile != JitProfile::Release) {
+            a.mov(qword_ptr(rsp), rbp); // Kept in the alignment slot to check no block lost the state pointer
+        }
+
+        for (const auto& [guest, host] : this->m_pinned_registers) {
+            a.movzx(host.r32(), byte_ptr(rbp, static_cast<int32_t>(guest)));
+        }
+        a.mov(rcx, arg_2);
+
+        a.bind(enter);
+        a.call(rcx);
+
+        // Blocks return with the next ip in rax, anything but a compiled successor within budget goes back to C++
+        a.bind(next);
+        if (this->m_profile != JitProfile::Release) {
+            const auto intact = a.new_label();
+            a.cmp(rbp, qword_ptr(rsp));
+            a.je(intact);
+            a.int3();
+            a.bind(intact);
+        }
+        a.cmp(dword_ptr(rbp, offsetof(CoreState, cycle_budget)), 0);
+        a.jle(leave);
+        a.cmp(byte_ptr(rbp, offsetof(CoreState, code_written)), 0);
+        a.jne(leave);
+        a.test(eax, non_table_bits);
+        a.jnz(leave);
+        a.mov(rcx, qword_ptr(rbp, offsetof(CoreState, dispatch_table)));
+        a.mov(rcx, qword_ptr(rcx, rax, 2)); // (ip >> 1) * sizeof(void*)
+        a.cmp(rcx, qword_ptr(rbp, offsetof(CoreState, miss_stub)));
+        a.jne(enter);
+
+        a.bind(leave);
+        for (const auto& [guest, host] : this->m_pinned_registers) {
+            a.mov(byte_ptr(rbp, static_cast<int32_t>(guest)), host);
+        }
+
+        a.add(rsp, 8);
+        for (const auto& reg : callee_saved | std::views::reverse) {
+            a.pop(reg);
+        }
+        a.ret();
+
+        if (this->m_rt.add(&this->m_dispatch_loop, &code) != asmjit::Error::kOk) {
+            throw std::runtime_error("Failed to create the dispatch loop");
+        }
+    }
+
+    void JitManager::emit_resolve_flag_stub() {
+        asmjit::CodeHolder code{};
+        code.init(this->m_rt.environment(), this->m_rt.cpu_features());
+        asmjit::x86::Assembler a{ &code };
+        const auto not_carry = a.new_label();
+        const auto bit = a.new_label();
+        const auto store = a.new_label();
+        const auto kind = byte_ptr(rbp, offsetof(CoreState, lazy_flag));
+
+        // Called from the middle of blocks with the state in rbp, so everything it touches is put back
+        a.push(rax);
+        a.push(rcx);
+        a.movzx(eax, byte_ptr(rbp, offsetof(CoreState, lazy_flag_operands)));
+        a.movzx(ecx, byte_ptr(rbp, offsetof(CoreState, lazy_flag_operands) + 1));
+
+        a.cmp(kind, std::to_underlying(LazyFlag::Carry));
+        a.jne(not_carry);
+        a.add(eax, ecx);
+        a.shr(eax, 8);
+        a.jmp(store);
+
+        a.bind(not_carry);
+        a.cmp(kind, std::to_underlying(LazyFlag::NoBorrow));
+        a.jne(bit);
+        a.cmp(eax, ecx);
+        a.setae(al);
+        a.jmp(store);
+
+        a.bind(bit);
+        a.shr(eax, cl);
+        a.and_(eax, 1);
+
+        a.bind(store);
+        a.mov(byte_ptr(rbp, static_cast<int32_t>(IRReg::VF)), al);
+        a.mov(kind, 0);
+        a.pop(rcx);
+        a.pop(rax);
+        a.ret();
+
+        if (this->m_rt.add(&this->m_resolve_flag_stub, &code) != asmjit::Error::kOk) {
+            throw std::runtime_error("Failed to create the lazy flag stub");
+        }
+    }
+
+    bool JitManager::should_compile(const uint16_t ip) noexcept {
+        if (this->m_shared_code == nullptr) {
+            return true;
+        }
+
+        switch (this->m_shared_code->claim(ip)) {
+        case SharedCode::Claim::Claimed:
+            this->m_claimed_blocks.insert(ip);
+            return true;
+        case SharedCode::Claim::InFlight:
+            return false;
+        case SharedCode::Claim::Published:
+            return true;
+        }
+
+        std::unreachable();
+    }
+
+    bool JitManager::install_shared_block(const uint16_t ip) noexcept {
+        if (this->m_shared_code == nullptr) {
+            return false;
+        }
+
+        const auto* shared = this->m_shared_code->find(ip);
+        if (shared == nullptr || !this->matches_memory(shared->code)) {
+            return false;
+        }
+
+        this->register_block(ip, JitBlock{ shared->entry, shared->code_size, ip, {}, shared->code, true });
+        return true;
+    }
+
+    void JitManager::open_code_cache(
+        const std::filesystem::path& directory, const std::span<const uint8_t> rom
+    ) noexcept {
+        const auto rom_hash = CodeCache::hash_rom(rom) ^ this->m_code_variant;
+
+        std::error_code error{};
+        std::filesystem::create_directories(directory, error);
+
+        this->m_code_cache = std::make_unique<CodeCache>();
+        // A cold start is the normal first run of a ROM, only worth mentioning when diagnosing the cache
+        if (!this->m_code_cache->open(directory / std::format("{:016x}.jitcache", rom_hash), rom_hash) &&
+            this->m_profile == JitProfile::Diagnostic) {
+            std::println("No usable JIT code cache for ROM {:016x}, starting cold", rom_hash);
+        }
+    }
+
+    void JitManager::save_code_cache() noexcept {
+        if (this->m_code_cache != nullptr && !this->m_code_cache->save() && this->m_profile == JitProfile::Diagnostic) {
+            std::println("Failed to save the JIT code cache");
+        }
+    }
+
+    bool JitManager::install_cached_block(const uint16_t ip) noexcept {
+        if (this->m_code_cache == nullptr) {
+            return false;
+        }
+
+        auto cached = this->m_code_cache->take(ip);
+        if (!cached.has_value() || !this->matches_memory(cached->words)) {
+            return false;
+        }
+
+        asmjit::CodeHolder holder{};
+        holder.init(this->m_rt.environment(), this->m_rt.cpu_features());
+        asmjit::x86::Assembler a{ &holder };
+        a.embed(cached->code.data(), cached->code.size());
+
+        void* memory;
+        if (this->m_rt.add(&memory, &holder) != asmjit::Error::kOk) {
+            return false;
+        }
+
+        auto block = JitBlock{ memory, cached->code.size(), ip, std::move(cached->exits), std::move(cached->words) };
+
+        // Taking it dropped it from the cache, it goes back in for the next run now that it's known to still be good
+        this->m_code_cache->store(block);
+        this->register_block(ip, std::move(block));
+        return true;
+    }
+
+    void JitManager::compile_ahead_of_time(const uint16_t entry_ip) {
+        const auto memory = std::span<const uint8_t>{ this->m_core_state->memory };
+        std::vector<JitBlock> blocks{};
+        std::vector<uint16_t> pending{ entry_ip };
+        std::unordered_set<uint16_t> discovered{ entry_ip };
+
+        // A block's exits are exactly its constant successors, jumps, calls, skips leaving it and falling off its end.
+        // Where a return goes is only known at runtime, but every call's continuation is, so that gets followed instead
+        while (!pending.empty()) {
+            const auto ip = pending.back();
+            pending.pop_back();
+
+            if (ip + 1 >= MemorySize || this->find_block(ip) != nullptr) {
+                continue;
+            }
+
+            InstructionList instructions{};
+            instructions.create_block(memory, ip);
+            // Starts on an invalid opcode, which the interpreter stalls on by itself, or on one the JIT can't lower,
+            // which the interpreter runs before coming back to compiled code
+            auto compiled = this->compile_instructions(instructions, ip, memory);
+            if (!compiled.has_value()) {
+                continue;
+            }
+
+            std::vector<uint16_t> successors{};
+            for (const auto& instr : instructions) {
+                if (instr.type() == InstructionType::Call && !instr.is_inlined()) {
+                    successors.emplace_back(static_cast<uint16_t>(instr.address() + 2));
+                }
+            }
+
+            const auto& block = blocks.emplace_back(std::move(*compiled));
+            for (const auto& exit : block.exits()) {
+                successors.emplace_back(exit.target_ip);
+            }
+
+            for (const auto successor : successors) {
+                if (discovered.insert(successor).second) {
+                    pending.emplace_back(successor);
+                }
+            }
+        }
+
+        if (blocks.empty()) {
+            return;
+        }
+
+        // Nothing in a block refers to where it lives, so each can be copied into the image as it is
+        std::vector<uint8_t> image{};
+        std::vector<size_t> offsets{};
+        for (const auto& block : blocks) {
+            image.resize((image.size() + ImageBlockAlignment - 1) & ~(ImageBlockAlignment - 1), 0xCC);
+            offsets.emplace_back(image.size());
+
+            const auto* code = static_cast<const uint8_t*>(block.entry());
+            image.insert(image.end(), code, code + block.code_size());
+            this->m_rt.release(block.entry());
+        }
+
+        asmjit::CodeHolder holder{};
+        holder.init(this->m_rt.environment(), this->m_rt.cpu_features());
+        asmjit::x86::Assembler a{ &holder };
+        a.embed(image.data(), image.size());
+
+        void* base;
+        if (const auto error = this->m_rt.add(&base, &holder); error != asmjit::Error::kOk) {
+            throw std::runtime_error(
+                std::format("Failed to allocate the ahead of time image: {}", static_cast<uint32_t>(error))
+            );
+        }
+        this->m_code_images.emplace_back(static_cast<const uint8_t*>(base), image.size());
+
+        for (const auto& [block, offset] : std::views::zip(blocks, offsets)) {
+            auto placed = JitBlock{
+                static_cast<uint8_t*>(base) + offset, block.code_size(), block.start_ip(), block.exits(), block.code()
+            };
+
+            if (this->m_code_cache != nullptr) {
+                this->m_code_cache->store(placed);
+            }
+            // Links every exit into a block already placed, and every one placed before into this one
+            this->register_block(placed.start_ip(), std::move(placed));
+        }
+    }
+
+    bool JitManager::in_code_image(const void* code) const noexcept {
+        const auto* address = static_cast<const uint8_t*>(code);
+
+        return std::ranges::any_of(this->m_code_images, [address](const std::span<const uint8_t> image) {
+            return address >= image.data() && address < image.data() + image.size();
+        });
+    }
+
+    void JitManager::compile_worker(const std::stop_token& stop) noexcept {
+        while (true) {
+            CompileRequest request{};
+            {
+                std::unique_lock lock{ this->m_compile_mutex };
+                if (!this->m_compile_ready.wait(lock, stop, [this] { return !this->m_compile_queue.empty(); })) {
+                    return;
+                }
+
+                request = std::move(this->m_compile_queue.front());
+                this->m_compile_queue.pop_front();
+            }
+
+            auto block = this->compile_trace(request.ip, request.memory, request.profile);
+            {
+                std::scoped_lock lock{ this->m_compile_mutex };
+                this->m_compiled_blocks.emplace_back(request.ip, std::move(block));
+                this->m_has_compiled_blocks.store(true, std::memory_order_release);
+            }
+        }
+    }
+
+    void JitManager::register_block(const uint16_t ip, JitBlock block) noexcept {
+        // Replacing a block has to drop everything that still refers to the old one first
+        this->invalidate_block(ip);
+
+        // The ahead of time image is only ever released as a whole, so its blocks neither count towards the budget nor
+        // get queued for an eviction which couldn't free anything
+        if (!this->in_code_image(block.entry())) {
+            while (this->m_resident_code_size + block.code_size() > this->m_code_cache_budget && this->evict_block()) {
+            }
+
+            this->m_resident_code_size += block.code_size();
+            // A replacement takes over the queue entry of the block it replaces, if that one is still queued
+            if (const auto slot = ip & (MemorySize - 1); !this->m_eviction_queued.test(slot)) {
+                this->m_eviction_queued.set(slot);
+                this->m_eviction_queue.emplace_back(ip);
+            }
+        }
+
+        for (const auto& [address, bytes] : block.code()) {
+            for (const auto byte : { address, static_cast<uint16_t>(address + 1) }) {
+                const auto masked = byte & (MemorySize - 1);
+                this->m_code_owners[masked].emplace_back(ip);
+                this->m_core_state->code_map[masked] = 1;
+            }
+        }
+
+        if (ip & 1) {
+            this->m_unaligned_blocks.insert_or_assign(ip, std::move(block));
+        } else {
+            this->m_blocks[ip >> 1] = std::move(block);
+            this->m_dispatch_table[ip >> 1] = this->m_blocks[ip >> 1]->entry();
+        }
+
+        const auto& registered = *this->find_block(ip);
+
+        for (const auto& [index, exit] : registered.exits() | std::views::enumerate) {
+            const auto site = LinkSite{ .source_ip = ip, .exit_index = static_cast<uint32_t>(index) };
+            const auto* target = this->find_block(exit.target_ip);
+
+            if (target != nullptr && this->link_exit(site, *target)) {
+                continue;
+            }
+
+            this->m_pending_exits[exit.target_ip].emplace_back(site);
+        }
+
+        const auto pending = this->m_pending_exits.find(ip);
+        if (pending == this->m_pending_exits.end()) {
+            return;
+        }
+
+        auto waiting = std::move(pending->second);
+        this->m_pending_exits.erase(pending);
+
+        for (const auto& site : waiting) {
+            if (!this->link_exit(site, registered)) {
+                this->m_pending_exits[ip].emplace_back(site);
+            }
+        }
+    }
+
+    void JitManager::invalidate_block(const uint16_t ip) noexcept {
+        const auto* block = this->find_block(ip);
+        if (block == nullptr) {
+            return;
+        }
+
+        // Everything jumping into us goes back through the dispatcher, and waits for whatever replaces us
+        if (const auto linked = this->m_linked_exits.find(ip); linked != this->m_linked_exits.end()) {
+            auto sites = std::move(linked->second);
+            this->m_linked_exits.erase(linked);
+
+            for (const auto& site : sites) {
+                this->unlink_exit(site);
+                this->m_pending_exits[ip].emplace_back(site);
+            }
+        }
+
+        // Our own exits die with our code, so they only need forgetting
+        const auto from_block = [ip](const LinkSite& site) { return site.source_ip == ip; };
+        for (const auto& exit : block->exits()) {
+            if (const auto linked = this->m_linked_exits.find(exit.target_ip); linked != this->m_linked_exits.end()) {
+                std::erase_if(linked->second, from_block);
+            }
+
+            if (const auto pending = this->m_pending_exits.find(exit.target_ip);
+                pending != this->m_pending_exits.end()) {
+                std::erase_if(pending->second, from_block);
+            }
+        }
+
+        for (const auto& [address, bytes] : block->code()) {
+            for (const auto byte : { address, static_cast<uint16_t>(address + 1) }) {
+                const auto masked = byte & (MemorySize - 1);
+                auto& owners = this->m_code_owners[masked];
+                // Blocks are registered once per address, even when the block covers it more than once
+                if (const auto it = std::ranges::find(owners, ip); it != owners.end()) {
+                    owners.erase(it);
+                }
+                this->m_core_state->code_map[masked] = owners.empty() ? 0 : 1;
+            }
+        }
+
+        // Nothing can be running the block, the dispatcher only ever calls this between blocks. The runtime's allocator
+        // has its own lock, so releasing is fine while the worker adds code
+        if (!this->in_code_image(block->entry())) {
+            this->m_resident_code_size -= block->code_size();
+            if (!block->is_shared()) {
+                this->m_rt.release(block->entry());
+            }
+        }
+
+        if (ip & 1) {
+            this->m_unaligned_blocks.erase(ip);
+        } else {
+            this->m_blocks[ip >> 1].reset();
+            this->m_dispatch_table[ip >> 1] = this->m_miss_stub;
+            this->m_execution_counts[ip >> 1] = 0;
+        }
+    }
+
+    bool JitManager::evict_block() noexcept {
+        // Second chance, any block entered since this last came round goes to the back of the queue once before it's
+        // evicted
+        for (auto remaining = 2 * this->m_eviction_queue.size(); remaining > 0; remaining--) {
+            const auto ip = this->m_eviction_queue.front();
+            const auto slot = ip & (MemorySize - 1);
+            this->m_eviction_queue.pop_front();
+
+            // Invalidated since it was queued, or replaced by a block of the ahead of time image which can't be freed
+            if (const auto* block = this->find_block(ip); block == nullptr || this->in_code_image(block->entry())) {
+                this->m_eviction_queued.reset(slot);
+                continue;
+            }
+
+            if (auto& used = this->m_core_state->recently_used[slot]; used != 0) {
+                used = 0;
+                this->m_eviction_queue.emplace_back(ip);
+                continue;
+            }
+
+            this->m_eviction_queued.reset(slot);
+            this->invalidate_block(ip);
+            this->m_code_cache_stats.evictions++;
+            return true;
+        }
+
+        return false;
+    }
+
+    JitManager::CodeCacheStats JitManager::code_cache_stats() const noexcept {
+        auto stats = this->m_code_cache_stats;
+        stats.resident_bytes = this->m_resident_code_size;
+        stats.resident_blocks = this->m_unaligned_blocks.size() +
+                                static_cast<size_t>(std::ranges::count_if(this->m_blocks, [](const auto& block) {
+                                    return block.has_value();
+                                }));
+        return stats;
+    }
+
+    void JitManager::invalidate_written_code() noexcept {
+        auto& state = *this->m_core_state;
+        std::vector<uint16_t> stale{};
+
+        for (uint16_t offset = 0; offset < state.code_write_length; offset++) {
+            const auto address = (state.code_write_start + offset) & (MemorySize - 1);
+            for (const auto owner : this->m_code_owners[address]) {
+                if (!std::ranges::contains(stale, owner)) {
+                    stale.emplace_back(owner);
+                }
+            }
+        }
+
+        // Only blocks whose instructions actually changed need to go, rewriting a byte with the same value is common
+        for (const auto ip : stale) {
+            if (const auto* block = this->find_block(ip); block != nullptr && !this->matches_memory(block->code())) {
+                this->invalidate_block(ip);
+                this->m_code_cache_stats.invalidations++;
+            }
+        }
+
+        state.code_written = 0;
+    }
+
+    bool JitManager::matches_memory(const std::span<const JitBlock::CodeWord> code) const noexcept {
+        const auto& memory = this->m_core_state->memory;
 
-    JitBlock JitManager::compile_block(const uint16_t current_ip, const MemoryStream& block_memory) noexcept {
-        InstructionList chip_instrs{};
-        chip_instrs.create_block(block_memory, current_ip);
+        return std::ranges::all_of(code, [&memory](const JitBlock::CodeWord& word) {
+            return word.address + 1 < MemorySize &&
+                   static_cast<uint16_t>(memory[word.address] << 8 | memory[word.address + 1]) == word.bytes;
+        });
+    }
 
-        auto ir = emit_ir(chip_instrs, current_ip);
-        LinearRegisterAllocator reg_allocator{};
-        reg_allocator.track(*ir);
+    bool JitManager::link_exit(const LinkSite& site, const JitBlock& target) noexcept {
+        const auto& source = *this->find_block(site.source_ip);
 
-        const auto compiler = std::make_unique<BlockCompiler>(this, std::move(ir), std::move(reg_allocator));
-        compiler->emit_machine_code(current_ip);
+        if (!patch_exit(source.patch_site(site.exit_index), target.entry())) {
+            return false;
+        }
 
-        return BlockCompiler::as_jit_block(compiler);
+        this->m_linked_exits[target.start_ip()].emplace_back(site);
+        return true;
     }
 
-    [[noreturn]] void JitManager::execute_loop(const uint16_t start_ip, const JitBlock start_block) noexcept {
-        this->m_blocks.emplace(std::pair{ start_ip, start_block });
-
-        this->m_execution_block = &this->m_blocks.at(start_ip);
-        while (true) {
-            const auto next_address = this->m_execution_block->execute();
+    void JitManager::unlink_exit(const LinkSite& site) noexcept {
+        auto* const patch_site = this->find_block(site.source_ip)->patch_site(site.exit_index);
 
-            auto it = this->m_blocks.find(next_address);
+        // A zero displacement lands on the instruction straight after the jmp, which is the `ret` to the dispatcher
+        patch_exit(patch_site, static_cast<uint8_t*>(patch_site) + sizeof(int32_t));
+    }
 
-            if (it == this->m_blocks.end()) {
-                auto [new_it, inserted] = this->m_blocks.emplace(
-                    next_address,
-                    this->compile_block(
-                        next_address, MemoryStream{ std::span{ this->m_core_state->memory }.subspan(next_address) }
-                    )
-                );
-                it = new_it;
-            }
+    bool JitManager::patch_exit(void* site, const void* target) noexcept {
+        const auto next_instruction = std::bit_cast<intptr_t>(site) + static_cast<intptr_t>(sizeof(int32_t));
+        const auto displacement = std::bit_cast<intptr_t>(target) - next_instruction;
 
-            this->m_execution_block = &it->second;
+        if (displacement < std::numeric_limits<int32_t>::min() || displacement > std::numeric_limits<int32_t>::max()) {
+            return false; // Out of reach of a rel32, the exit keeps going through the dispatcher
         }
+
+        const auto rel32 = static_cast<int32_t>(displacement);
+        asmjit::VirtMem::ProtectJitReadWriteScope scope{ site, sizeof(rel32) };
+        std::memcpy(site, &rel32, sizeof(rel32));
+        return true;
     }
 
-    std::unique_ptr<IRManager>
-    JitManager::emit_ir(const InstructionList& instructions, const uint16_t start_ip) noexcept {
+    std::unique_ptr<IRManager> JitManager::emit_ir(const InstructionList& instructions) noexcept {
         auto ir_manager = std::make_unique<IRManager>();
         ir_manager->init_jump_points(instructions.jump_points());
+        ir_manager->init_loop_headers(instructions.loop_headers());
 
-        for (const auto& [index, instr] : instructions | std::views::enumerate) {
-            ir_manager->emit(instr, static_cast<uint16_t>(index) * 2 + start_ip);
+        for (const auto& instr : instructions) {
+            ir_manager->emit(instr, instr.address());
         }
 
+        ir_manager->close_block(instructions.end_ip());
+
         return ir_manager;
     }
 
@@ -191,27 +1020,30 @@ namespace jip {
         }
 
         using namespace asmjit::x86;
-        this->m_register_allocator.initialize_free_regs(
-            { r15b, r14b, r13b, r12b, r11b, r10b, r9b, r8b, dil, sil, dl, cl, bl, al }
-        );
-
-        this->m_register_allocator.initialize_clobber_aware_registers({ bl, bpl, r12b, r13b, r14b, r15b });
+        std::vector<RegType> free_regs{ r15b, r14b, r13b, r12b, r11b, r10b, r9b, r8b, dil, sil, dl, cl, bl, al };
+        for (const auto& [guest, host] : this->m_manager->m_pinned_registers) {
+            std::erase(free_regs, host);
+        }
+        this->m_register_allocator.initialize_free_regs(std::move(free_regs));
     }
 
-    void JitManager::BlockCompiler::emit_machine_code(const uint16_t ip) {
+    void JitManager::BlockCompiler::emit_machine_code(const uint16_t ip, const uint32_t cost) {
         auto& a = this->m_builder;
         auto* original_prev = a.cursor()->prev();
 
         uint32_t current_ip{ 0 };
         cip::StaticVector<LinearRegisterAllocator::UsedRegInfo, GPRegCount, uint8_t> regs_to_store{};
-        this->m_register_allocator.add_clobbered(bpl);
 
         for (const auto& block : this->m_ir->blocks()) {
             auto& label = this->label_for_block(block);
 
             a.bind(label);
+            // Other blocks of the IR can branch here, so a flag may be pending whichever way this was reached
+            this->m_flag_pending = true;
+            this->m_flag_record_armed = false;
 
-            for (const auto& instr : block.instructions()) {
+            const auto& instructions = block.instructions();
+            for (const auto& [index, instr] : instructions | std::views::enumerate) {
                 this->m_register_allocator.free_if_possible(
                     current_ip, this->m_spill_mapping, this->m_spill_free_offsets, regs_to_store
                 );
@@ -224,43 +1056,86 @@ namespace jip {
                 regs_to_store.clear();
 
                 this->compile_instruction(instr, current_ip);
+                if (this->m_manager->m_lazy_flags) {
+                    this->track_lazy_flag(instr);
+                }
+
+                // A FlagRegisterCheck right after reads the host flags this left behind
+                const auto next = static_cast<size_t>(index) + 1;
+                this->m_host_flags_live =
+                    next < instructions.size() && instructions[next].code == IROpcode::FlagRegisterCheck;
 
                 current_ip++;
             }
         }
 
-        for (auto* node : this->m_restore_locations) {
-            a.set_cursor(node);
-            this->emit_clobber_restore();
-        }
-
         a.set_cursor(original_prev);
 
-        const auto clobbered = this->m_register_allocator.clobbered_regs();
-
-        for (const auto& reg : clobbered) {
-            a.push(remap_8_64(reg));
+        // Only now is the spill area's size final, every exit emitted before gives back just as much as the prologue
+        // below reserves
+        for (auto* release : this->m_spill_releases) {
+            if (this->m_last_spill_offset == 0) {
+                a.remove_node(release);
+            } else {
+                release->set_op(1, asmjit::Imm(this->m_last_spill_offset));
+            }
         }
 
-        a.sub(StackPointer, this->m_last_spill_offset);
-        a.mov(CoreStatePointer, std::bit_cast<uintptr_t>(this->m_manager->m_core_state));
+        // Every way into the block goes through here, so each block entered is charged in full up front, before the
+        // spill area is reserved, leaving nothing to undo when the budget has run out
+        const auto enter = a.new_label();
+        a.sub(dword_ptr(CoreStatePointer, offsetof(CoreState, cycle_budget)), cost);
+        a.jg(enter);
+        a.mov(eax, ip);
+        a.ret();
+        a.bind(enter);
+        // Linked exits and the dispatch loop enter blocks without C++ ever seeing it, so each block marks itself used
+        const auto used_offset = offsetof(CoreState, recently_used) + (ip & (MemorySize - 1));
+        a.mov(byte_ptr(CoreStatePointer, static_cast<int32_t>(used_offset)), 1);
+
+        // The dispatch loop already saved every callee saved register and holds the state pointer in rbp, so that's
+        // all the frame a block has
+        if (this->m_last_spill_offset != 0) {
+            a.sub(StackPointer, this->m_last_spill_offset);
+        }
+        this->m_start_ip = ip;
 
-        asmjit::String str{};
-        constexpr asmjit::FormatOptions opts{};
-        asmjit::Formatter::format_node_list(str, opts, &this->m_builder);
-        std::println("{}", std::string{ str.data() });
+        if (this->m_manager->m_profile == JitProfile::Diagnostic) {
+            asmjit::String str{};
+            constexpr asmjit::FormatOptions opts{};
+            asmjit::Formatter::format_node_list(str, opts, &this->m_builder);
+            std::println("{}", std::string{ str.data() });
+        }
     }
 
-    JitBlock JitManager::BlockCompiler::as_jit_block(const std::unique_ptr<BlockCompiler>& compiler) {
+    JitBlock JitManager::BlockCompiler::as_jit_block(
+        const std::unique_ptr<BlockCompiler>& compiler, std::vector<JitBlock::CodeWord> code
+    ) {
         auto error = compiler->m_builder.finalize();
 
         if (error == asmjit::Error::kOk) {
             void* memory;
-            std::println("Block Size: 0x{:x}", compiler->m_code.code_size());
+            const auto profile = compiler->m_manager->m_profile;
+            if (profile == JitProfile::Diagnostic) {
+                std::println("Block Size: 0x{:x}", compiler->m_code.code_size());
+            }
             error = compiler->m_manager->m_rt.add(&memory, &compiler->m_code);
 
             if (error == asmjit::Error::kOk) {
-                return JitBlock{ memory };
+                std::vector<JitBlock::Exit> exits{};
+                for (const auto& [label, target_ip] : compiler->m_exit_sites) {
+                    // The rel32 displacement follows the single opcode byte of the jmp
+                    const auto offset = compiler->m_code.label_offset_from_base(label) + 1;
+                    exits.emplace_back(static_cast<uint32_t>(offset), target_ip);
+                }
+
+                if (profile != JitProfile::Release) {
+                    validate_block(memory, compiler->m_code.code_size(), exits);
+                }
+
+                return JitBlock{
+                    memory, compiler->m_code.code_size(), compiler->m_start_ip, std::move(exits), std::move(code)
+                };
             }
         }
 
@@ -281,6 +1156,9 @@ namespace jip {
         case IROpcode::AndImm:
             this->compile_and_imm(instruction, current_ip);
             return;
+        case IROpcode::AddIndexReg:
+            this->compile_add_index_reg(instruction, current_ip);
+            return;
         case IROpcode::LoadByteFromI:
             this->compile_load_byte_index_reg(instruction, current_ip);
             return;
@@ -302,6 +1180,16 @@ namespace jip {
         case IROpcode::JmpNeReg:
             this->compile_jump_ne_reg(instruction, current_ip);
             return;
+        case IROpcode::JmpKeyDown:
+        case IROpcode::JmpKeyUp:
+            this->compile_jump_key(instruction, current_ip);
+            return;
+        case IROpcode::ReadTimer:
+            this->compile_read_timer(instruction, current_ip);
+            return;
+        case IROpcode::WriteTimer:
+            this->compile_write_timer(instruction, current_ip);
+            return;
         case IROpcode::XorDisplayMemory:
             this->compile_xor_display_memory(instruction, current_ip);
             return;
@@ -314,6 +1202,9 @@ namespace jip {
         case IROpcode::JmpJit:
             this->compile_jump_jit(instruction, current_ip);
             return;
+        case IROpcode::JmpDynamic:
+            this->compile_jump_dynamic(instruction, current_ip);
+            return;
         case IROpcode::ReadStackOffset:
             this->compile_read_stack_offset(instruction, current_ip);
             return;
@@ -359,9 +1250,37 @@ namespace jip {
         case IROpcode::ReadFromMemory:
             this->compile_read_from_memory(instruction, current_ip);
             return;
+        case IROpcode::WriteToMemory:
+            this->compile_write_to_memory(instruction, current_ip);
+            return;
+        case IROpcode::RecordCodeWrite:
+            this->compile_record_code_write(instruction, current_ip);
+            return;
+        case IROpcode::ExitIfCodeWritten:
+            this->compile_exit_if_code_written(instruction, current_ip);
+            return;
+        case IROpcode::LoopPreheader:
+            this->compile_loop_preheader(instruction, current_ip);
+            return;
+        case IROpcode::LoopBackEdge:
+            this->compile_loop_back_edge(instruction, current_ip);
+            return;
+        case IROpcode::IdleWait:
+            this->compile_idle_wait(instruction, current_ip);
+            return;
+        case IROpcode::RecordLazyFlag:
+            this->compile_record_lazy_flag(instruction, current_ip);
+            return;
+        case IROpcode::LoadReg:
+            this->compile_load_reg(instruction, current_ip);
+            return;
+        case IROpcode::ShrImm:
+            this->compile_shr_imm(instruction, current_ip);
+            return;
         default:
-            std::println("Unknown instruction!: {:x}", static_cast<uint32_t>(instruction.code));
-            // throw std::runtime_error("Unhandled instruction code");
+            if (!this->m_unhandled_opcode.has_value()) {
+                this->m_unhandled_opcode = instruction.code;
+            }
         }
     }
 
@@ -396,14 +1315,26 @@ namespace jip {
         a.add(vx, vy);
     }
 
+    void JitManager::BlockCompiler::compile_add_index_reg(const IRInstruction& instruction, const uint32_t current_ip) {
+        auto& a = this->m_builder;
+        const auto index = this->get_reg(*instruction.vx, current_ip);
+        const auto vy = this->get_reg(*instruction.vy, current_ip);
+        const auto scratch = this->get_reg(instruction.extra_consumed_registers[0].first, current_ip);
+
+        a.movzx(remap_8_32(scratch), vy);
+        a.add(index, remap_8_16(scratch));
+    }
+
     void JitManager::BlockCompiler::compile_sub(const IRInstruction& instruction, const uint32_t current_ip) {
         auto& a = this->m_builder;
         const auto vx = this->get_reg(*instruction.vx, current_ip);
         const auto vy = this->get_reg(*instruction.vy, current_ip);
+        const auto scratch = this->get_reg(instruction.extra_consumed_registers[0].first, current_ip);
 
-        a.xchg(vx, vy);
-        a.sub(vx, vy);
-        a.xchg(vx, vy);
+        // VX = VY - VX, the movs leave the borrow from the sub for the flag check
+        a.mov(scratch, vy);
+        a.sub(scratch, vx);
+        a.mov(vx, scratch);
     }
 
     void JitManager::BlockCompiler::compile_sub_inverse(const IRInstruction& instruction, const uint32_t current_ip) {
@@ -477,6 +1408,7 @@ namespace jip {
 
         auto& a = this->m_builder;
         const auto flag_reg = this->get_reg(*instruction.vx, current_ip);
+        this->m_host_flags_live = false;
 
         if (operation == 0xADD || operation == 0x55B || operation == 0x5179 || operation == 0x5171) {
             a.setc(flag_reg);
@@ -580,9 +1512,34 @@ namespace jip {
     void
     JitManager::BlockCompiler::compile_load_reg(const IRInstruction& instruction, const uint32_t current_ip) noexcept {
         auto& a = this->m_builder;
-        const auto src = this->get_reg(*instruction.vx, current_ip);
-        const auto dst = this->get_reg(*instruction.vy, current_ip);
+        const auto source = *instruction.vx;
+        const auto target = *instruction.vy;
+        const auto src = this->get_reg(source, current_ip);
+        const auto target_reg = this->m_register_allocator.get_ir_reg(target.reg);
+
+        if (target.is_temp || !this->pinned_register(target.reg).has_value()) {
+            // Nothing after this touches the target, copy propagation having moved its reads over to the source, so the
+            // copy only has to reach the state. Whatever host register the target still had is stale from here on
+            if (target_reg != IRReg::Invalid && target_reg != IRReg::IN &&
+                this->m_register_allocator.dies_at(target.reg, current_ip)) {
+                this->m_register_allocator.release(target.reg);
+                a.mov(byte_ptr(CoreStatePointer, static_cast<int32_t>(target_reg)), src);
+                return;
+            }
+
+            // The source is never read again, so the target can just take its host register over
+            if (const auto previous = this->m_register_allocator.coalesce(source.reg, target.reg, current_ip);
+                previous.has_value()) {
+                this->emit_register_backup(*previous);
+                if (const auto spill = this->m_spill_mapping.find(source.reg); spill != this->m_spill_mapping.end()) {
+                    this->m_spill_free_offsets.push_back(spill->second);
+                    this->m_spill_mapping.erase(spill);
+                }
+                return;
+            }
+        }
 
+        const auto dst = this->get_reg(target, current_ip);
         if (dst != src) {
             a.mov(dst, src);
         }
@@ -648,20 +1605,220 @@ namespace jip {
         a.jne(this->label_for_block(instruction.immediate));
     }
 
+    void
+    JitManager::BlockCompiler::compile_jump_key(const IRInstruction& instruction, const uint32_t current_ip) noexcept {
+        auto& a = this->m_builder;
+        const auto vx = this->get_reg(*instruction.vx, current_ip);
+        const auto key = this->get_reg(instruction.extra_consumed_registers[0].first, current_ip);
+
+        // Only the low nibble names a key, like the interpreter
+        a.movzx(remap_8_32(key), vx);
+        a.and_(remap_8_32(key), KeyCount - 1);
+        a.cmp(byte_ptr(CoreStatePointer, remap_8_64(key), 0, offsetof(CoreState, keys)), 0);
+        if (instruction.code == IROpcode::JmpKeyDown) {
+            a.jne(this->label_for_block(instruction.immediate));
+        } else {
+            a.je(this->label_for_block(instruction.immediate));
+        }
+    }
+
+    void JitManager::BlockCompiler::compile_read_timer(
+        const IRInstruction& instruction, const uint32_t current_ip
+    ) noexcept {
+        auto& a = this->m_builder;
+        const auto vx = this->get_reg(*instruction.vx, current_ip);
+
+        a.mov(vx, byte_ptr(CoreStatePointer, static_cast<int32_t>(instruction.immediate)));
+    }
+
+    void JitManager::BlockCompiler::compile_write_timer(
+        const IRInstruction& instruction, const uint32_t current_ip
+    ) noexcept {
+        auto& a = this->m_builder;
+        const auto vx = this->get_reg(*instruction.vx, current_ip);
+
+        a.mov(byte_ptr(CoreStatePointer, static_cast<int32_t>(instruction.immediate)), vx);
+    }
+
     void JitManager::BlockCompiler::compile_jump_jit(const IRInstruction& instruction, uint32_t) noexcept {
         using namespace asmjit;
         auto& a = this->m_builder;
         const auto target_ip = instruction.immediate;
 
         this->emit_register_saves();
-        this->add_clobber_restore_point();
         // Stack is already aligned :D
 
         a.mov(rax, target_ip);
         this->emit_stack_alignment_check();
+
+        // Patching shared code would redirect every instance running it, so it goes through the dispatch table of
+        // whichever instance is running instead
+        if (this->m_manager->m_shared_code != nullptr) {
+            this->emit_dispatch_exit();
+            return;
+        }
+
+        this->emit_linkable_exit(static_cast<uint16_t>(target_ip));
+        a.ret();
+    }
+
+    void JitManager::BlockCompiler::compile_loop_preheader(
+        const IRInstruction& instruction, const uint32_t current_ip
+    ) noexcept {
+        auto& allocator = this->m_register_allocator;
+        auto loop_registers = allocator.loop_registers(instruction.immediate);
+        auto& loop = this->m_loops[instruction.immediate];
+        loop.header_ip = static_cast<uint16_t>(instruction.immediate_2);
+
+        // Pinned guest registers are already where the loop needs them, and what they live in is out of the pool
+        const auto pinned_count = this->m_manager->m_pinned_registers.size();
+        if (loop_registers.has_value()) {
+            std::erase_if(*loop_registers, [this](const uint32_t reg) {
+                return this->pinned_register(reg).has_value();
+            });
+        }
+
+        // Without enough registers to go around the back edge exits through the dispatcher like any other jump
+        if (!loop_registers.has_value() ||
+            loop_registers->size() + pinned_count > LinearRegisterAllocator::MaxPinnedRegisters) {
+            return;
+        }
+
+        // Whatever the loop doesn't use goes back to the CoreState now, so the body can't spill it every iteration
+        const auto held = allocator.allocated_regs();
+        for (const auto& reg : held) {
+            if (!std::ranges::contains(*loop_registers, reg.reg_index)) {
+                this->emit_register_backup(reg);
+                allocator.release(reg.reg_index);
+            }
+        }
+
+        // The header is entered both from here and from the back edge, so every loop register has to already be in
+        // its host register on both paths
+        for (const auto reg : *loop_registers) {
+            const auto was_held = std::ranges::contains(held, reg, &LinearRegisterAllocator::UsedRegInfo::reg_index);
+            // Whatever gets evicted to make room is written back like in get_reg. The load is left to below, the
+            // loop's first access being a write doesn't make the CoreState value dead, an exit can run before it
+            const auto action = allocator.allocate(reg, current_ip);
+            this->emit_spill(action);
+            const auto host = action.reg_type;
+            allocator.pin(reg);
+            if (allocator.loop_writes(instruction.immediate, reg)) {
+                allocator.mark_dirty(reg);
+            }
+
+            if (!was_held) {
+                this->emit_register_load(reg, host);
+            }
+        }
+
+        loop.native = true;
+    }
+
+    void JitManager::BlockCompiler::compile_loop_back_edge(
+        const IRInstruction& instruction, const uint32_t current_ip
+    ) noexcept {
+        using namespace asmjit;
+        auto& a = this->m_builder;
+        const auto [header_ip, native] = this->m_loops.at(instruction.immediate);
+
+        // Leaving through the exit charges the header's block again on entry, which covers the iteration
+        if (!native) {
+            this->compile_jump_jit({ .code = IROpcode::JmpJit, .immediate = header_ip }, current_ip);
+            return;
+        }
+
+        a.sub(dword_ptr(CoreStatePointer, offsetof(CoreState, cycle_budget)), instruction.immediate_2);
+        a.jg(this->label_for_block(static_cast<uint16_t>(instruction.immediate)));
+
+        // Out of budget, the header is where execution picks up again once the dispatcher gets another slice
+        this->emit_register_saves();
+        a.mov(rax, header_ip);
+        this->emit_stack_alignment_check();
+        a.ret();
+
+        this->m_register_allocator.unpin_all();
+    }
+
+    void JitManager::BlockCompiler::compile_idle_wait(const IRInstruction& instruction, uint32_t) noexcept {
+        using namespace asmjit;
+        auto& a = this->m_builder;
+
+        // Iterating again would change nothing, so the rest of the budget is given up until the event happens
+        this->emit_register_saves();
+        a.mov(byte_ptr(CoreStatePointer, offsetof(CoreState, wait_event)), instruction.immediate_2);
+        a.mov(dword_ptr(CoreStatePointer, offsetof(CoreState, cycle_budget)), 0);
+        a.mov(rax, instruction.immediate);
+        this->emit_stack_alignment_check();
         a.ret();
     }
 
+    void JitManager::BlockCompiler::compile_record_lazy_flag(
+        const IRInstruction& instruction, const uint32_t current_ip
+    ) {
+        auto& a = this->m_builder;
+        const auto operands = static_cast<int32_t>(offsetof(CoreState, lazy_flag_operands));
+
+        a.mov(byte_ptr(CoreStatePointer, operands), this->get_reg(*instruction.vx, current_ip));
+        if (instruction.vy.has_value()) {
+            a.mov(byte_ptr(CoreStatePointer, operands + 1), this->get_reg(*instruction.vy, current_ip));
+        } else {
+            a.mov(byte_ptr(CoreStatePointer, operands + 1), instruction.immediate_2);
+        }
+        a.mov(byte_ptr(CoreStatePointer, offsetof(CoreState, lazy_flag)), instruction.immediate);
+    }
+
+    void JitManager::BlockCompiler::emit_flag_resolve() noexcept {
+        if (!this->m_manager->m_lazy_flags) {
+            return;
+        }
+
+        // The cmp and the stub both clobber the host flags, which a FlagRegisterCheck may be about to read
+        assert(!this->m_host_flags_live);
+
+        auto& a = this->m_builder;
+        const auto resolved = a.new_label();
+
+        a.cmp(byte_ptr(CoreStatePointer, offsetof(CoreState, lazy_flag)), std::to_underlying(LazyFlag::None));
+        a.je(resolved);
+        a.call(qword_ptr(CoreStatePointer, offsetof(CoreState, resolve_flag_stub)));
+        a.bind(resolved);
+    }
+
+    void JitManager::BlockCompiler::track_lazy_flag(const IRInstruction& instruction) {
+        if (instruction.code == IROpcode::RecordLazyFlag) {
+            this->m_flag_record_armed = true;
+            return;
+        }
+
+        // The operation the flag was recorded for, VF is its result from here on
+        if (this->m_flag_record_armed) {
+            this->m_flag_record_armed = false;
+            this->m_flag_pending = true;
+            return;
+        }
+
+        if (!this->m_flag_pending) {
+            return;
+        }
+
+        const auto access = IRManager::access_info(instruction);
+        const auto writes_flag = [this, access](const auto& pointer, const RegisterAccessInfo write) {
+            return pointer.has_value() && !pointer->is_temp && (access & write) == write &&
+                   this->m_register_allocator.get_ir_reg(pointer->reg) == IRReg::VF;
+        };
+
+        // Whatever was recorded would overwrite this VF when it's resolved. Only a mov, so the host flags a following
+        // FlagRegisterCheck reads survive it
+        if (writes_flag(instruction.vx, RegisterAccessInfo::VXWrite) ||
+            writes_flag(instruction.vy, RegisterAccessInfo::VYWrite)) {
+            this->m_builder.mov(
+                byte_ptr(CoreStatePointer, offsetof(CoreState, lazy_flag)), std::to_underlying(LazyFlag::None)
+            );
+            this->m_flag_pending = false;
+        }
+    }
+
     void JitManager::BlockCompiler::compile_read_stack_offset(
         const IRInstruction& instruction, const uint32_t current_ip
     ) noexcept {
@@ -682,6 +1839,11 @@ namespace jip {
 
     static_assert(StackType::offset_of_size() == 32);
 
+    // The JIT indexes the stack with its size after a push and before a pop, so everything is addressed one slot back
+    // to land on the same `storage[size - 1]` that StackType::push and StackType::pop use
+    constexpr static auto StackTopDisplacement =
+        static_cast<int32_t>(offsetof(CoreState, stack) + StackType::offset_of_storage() - sizeof(uint16_t));
+
     void JitManager::BlockCompiler::compile_write_to_stack_with_offset(
         const IRInstruction& instruction, const uint32_t current_ip
     ) noexcept {
@@ -691,10 +1853,7 @@ namespace jip {
         const auto value = instruction.immediate;
 
         a.movzx(offset_reg_32, offset_reg);
-        a.mov(
-            word_ptr(CoreStatePointer, offset_reg_32, 1, offsetof(CoreState, stack) + StackType::offset_of_storage()),
-            value
-        );
+        a.mov(word_ptr(CoreStatePointer, offset_reg_32, 1, StackTopDisplacement), value);
     }
 
     void JitManager::BlockCompiler::compile_jump_to_stack_with_offset_and_decrement(
@@ -709,18 +1868,27 @@ namespace jip {
         // point on
 
         a.movzx(offset, small_offset);
-        a.mov(
-            return_scratch,
-            word_ptr(CoreStatePointer, offset, 1, offsetof(CoreState, stack) + StackType::offset_of_storage())
-        );
+        a.mov(return_scratch, word_ptr(CoreStatePointer, offset, 1, StackTopDisplacement));
         a.dec(offset);
         a.mov(byte_ptr(CoreStatePointer, offsetof(CoreState, stack) + StackType::offset_of_size()), small_offset);
 
-        a.movzx(rax, return_scratch);
+        a.movzx(eax, return_scratch);
         // Stack is already aligned :D
-        this->add_clobber_restore_point();
         this->emit_stack_alignment_check();
-        a.ret();
+        this->emit_dispatch_exit();
+    }
+
+    void JitManager::BlockCompiler::compile_jump_dynamic(
+        const IRInstruction& instruction, const uint32_t current_ip
+    ) noexcept {
+        auto& a = this->m_builder;
+        const auto v0 = this->get_reg(*instruction.vx, current_ip);
+        this->emit_register_saves(); // V0 may well live in al, so it has to be read before rax is written
+
+        a.movzx(eax, v0);
+        a.add(eax, instruction.immediate);
+        this->emit_stack_alignment_check();
+        this->emit_dispatch_exit();
     }
 
     void JitManager::BlockCompiler::compile_div_imm(const IRInstruction& instruction, const uint32_t current_ip) {
@@ -798,6 +1966,95 @@ namespace jip {
 
         const auto index = this->get_reg(*instruction.vx, uint32);
         const auto dst = this->get_reg(*instruction.vy, uint32);
+        const auto address = this->get_reg(instruction.extra_consumed_registers[0].first, uint32);
+
+        this->emit_guest_address(index, address, instruction.immediate);
+        a.mov(dst, byte_ptr(CoreStatePointer, remap_8_64(address), 0, offsetof(CoreState, memory)));
+    }
+
+    void JitManager::BlockCompiler::compile_write_to_memory(const IRInstruction& instruction, uint32_t current_ip) {
+        auto& a = this->m_builder;
+
+        const auto index = this->get_reg(*instruction.vx, current_ip);
+        const auto value = this->get_reg(*instruction.vy, current_ip);
+        const auto address = this->get_reg(instruction.extra_consumed_registers[0].first, current_ip);
+        const auto address_64 = remap_8_64(address);
+
+        this->emit_guest_address(index, address, instruction.immediate);
+        a.mov(byte_ptr(CoreStatePointer, address_64, 0, offsetof(CoreState, memory)), value);
+
+        // Branchless, the address is dead after this so it doubles as the scratch for the code map entry
+        a.mov(address, byte_ptr(CoreStatePointer, address_64, 0, offsetof(CoreState, code_map)));
+        a.or_(byte_ptr(CoreStatePointer, offsetof(CoreState, code_written)), address);
+    }
+
+    void JitManager::BlockCompiler::compile_record_code_write(
+        const IRInstruction& instruction, const uint32_t current_ip
+    ) noexcept {
+        auto& a = this->m_builder;
+        const auto index = this->get_reg(*instruction.vx, current_ip);
+
+        a.mov(word_ptr(CoreStatePointer, offsetof(CoreState, code_write_start)), index);
+        a.mov(byte_ptr(CoreStatePointer, offsetof(CoreState, code_write_length)), instruction.immediate);
+    }
+
+    void JitManager::BlockCompiler::compile_exit_if_code_written(const IRInstruction& instruction, uint32_t) noexcept {
+        using namespace asmjit;
+        auto& a = this->m_builder;
+        const auto unchanged = a.new_label();
+
+        a.cmp(byte_ptr(CoreStatePointer, offsetof(CoreState, code_written)), 0);
+        a.je(unchanged);
+
+        // The rest of the block may well be what just got overwritten
+        this->emit_register_saves();
+        a.mov(rax, instruction.immediate);
+        this->emit_stack_alignment_check();
+        a.ret();
+
+        a.bind(unchanged);
+    }
+
+    void JitManager::BlockCompiler::emit_guest_address(
+        const RegType& index, const RegType& address, const uint32_t offset
+    ) noexcept {
+        auto& a = this->m_builder;
+        const auto address_32 = remap_8_32(address);
+
+        a.movzx(address_32, index);
+        if (offset != 0) {
+            a.add(address_32, offset);
+        }
+        a.and_(address_32, MemorySize - 1);
+    }
+
+    void JitManager::BlockCompiler::emit_linkable_exit(const uint16_t target_ip) noexcept {
+        auto& a = this->m_builder;
+        const auto site = a.new_label();
+        const auto unlinked = a.new_label();
+
+        // Always a rel32 so the JitManager can patch it into a jump to the successor block once it exists, until then
+        // it just falls into the `ret` that follows
+        a.bind(site);
+        a.long_().jmp(unlinked);
+        a.bind(unlinked);
+
+        this->m_exit_sites.emplace_back(site, target_ip);
+    }
+
+    // Expects the target ip zero extended in rax and the stack as it was on entry. Odd
+    // or out of range targets return to the dispatcher, everything else is one indexed jump through the dispatch table
+    void JitManager::BlockCompiler::emit_dispatch_exit() noexcept {
+        auto& a = this->m_builder;
+        const auto slow_path = a.new_label();
+        constexpr auto non_table_bits = ~static_cast<uint32_t>(MemorySize - 2);
+
+        a.test(eax, non_table_bits);
+        a.jnz(slow_path);
+        a.mov(r11, qword_ptr(CoreStatePointer, offsetof(CoreState, dispatch_table)));
+        a.jmp(qword_ptr(r11, rax, 2)); // (ip >> 1) * sizeof(void*)
+        a.bind(slow_path);
+        a.ret();
     }
 
     asmjit::Label& JitManager::BlockCompiler::label_for_block(const IRManager::IRBlock& block) noexcept {
@@ -808,26 +2065,31 @@ namespace jip {
         return this->m_block_labels[this->m_ir->blocks()[block_id].block_id()];
     }
 
-    RegType JitManager::BlockCompiler::get_reg(const RegisterPointer pointer, const uint32_t rel_ip) noexcept {
-        const auto action = this->m_register_allocator.allocate(pointer.reg, rel_ip);
-        auto& a = this->m_builder;
+    std::optional<RegType> JitManager::BlockCompiler::pinned_register(const uint32_t reg_index) const noexcept {
+        const auto reg = this->m_register_allocator.get_ir_reg(reg_index);
+
+        for (const auto& [guest, host] : this->m_manager->m_pinned_registers) {
+            if (static_cast<uint16_t>(reg) == guest) {
+                return host;
+            }
+        }
 
-        if ((action.actions & LinearRegisterAllocator::Actions::Spill) == LinearRegisterAllocator::Actions::Spill) {
-            const auto spill_register = action.spill_info.register_index;
-            const auto reg = this->m_register_allocator.get_ir_reg(spill_register);
+        return std::nullopt;
+    }
 
-            if (reg == IRReg::Invalid) {
-                const auto offset_from_stack = this->get_spill_offset_for_temp_reg(spill_register);
-                a.mov(dword_ptr(StackPointer, static_cast<int32_t>(offset_from_stack)), remap_8_32(action.reg_type));
-            } else if (static_cast<uint16_t>(reg) < 16) {
-                a.mov(byte_ptr(CoreStatePointer, static_cast<int32_t>(reg)), action.reg_type);
-            } else if (reg == IRReg::IN) {
-                a.mov(word_ptr(CoreStatePointer, static_cast<int32_t>(reg)), remap_8_16(action.reg_type));
-            } else {
-                throw std::logic_error("Unhandled register");
+    RegType JitManager::BlockCompiler::get_reg(const RegisterPointer pointer, const uint32_t rel_ip) noexcept {
+        // Never loaded or written back by a block, the dispatch loop does both once around all of them
+        if (!pointer.is_temp) {
+            if (const auto pinned = this->pinned_register(pointer.reg); pinned.has_value()) {
+                return *pinned;
             }
         }
 
+        const auto action = this->m_register_allocator.allocate(pointer.reg, rel_ip);
+        auto& a = this->m_builder;
+
+        this->emit_spill(action);
+
         if ((action.actions & LinearRegisterAllocator::Actions::Load) == LinearRegisterAllocator::Actions::Load &&
             pointer.is_temp) {
             a.mov(
@@ -840,6 +2102,9 @@ namespace jip {
             const auto offset = this->m_register_allocator.get_ir_reg(pointer.reg);
 
             if (static_cast<uint16_t>(offset) < 16) {
+                if (offset == IRReg::VF) {
+                    this->emit_flag_resolve();
+                }
                 a.mov(action.reg_type, byte_ptr(CoreStatePointer, static_cast<uint16_t>(offset)));
             } else if (offset == IRReg::IN) {
                 const auto remapped = remap_8_16(action.reg_type);
@@ -857,6 +2122,45 @@ namespace jip {
         return action.reg_type;
     }
 
+    void JitManager::BlockCompiler::emit_spill(const LinearRegisterAllocator::RequiredAction& action) {
+        if ((action.actions & LinearRegisterAllocator::Actions::Spill) != LinearRegisterAllocator::Actions::Spill) {
+            return;
+        }
+
+        auto& a = this->m_builder;
+        const auto spill_register = action.spill_info.register_index;
+        const auto reg = this->m_register_allocator.get_ir_reg(spill_register);
+
+        if (reg == IRReg::Invalid) {
+            const auto offset_from_stack = this->get_spill_offset_for_temp_reg(spill_register);
+            a.mov(dword_ptr(StackPointer, static_cast<int32_t>(offset_from_stack)), remap_8_32(action.reg_type));
+        } else if (!action.spill_info.dirty) {
+            // The CoreState still holds what it was loaded with
+        } else if (static_cast<uint16_t>(reg) < 16) {
+            a.mov(byte_ptr(CoreStatePointer, static_cast<int32_t>(reg)), action.reg_type);
+        } else if (reg == IRReg::IN) {
+            a.mov(word_ptr(CoreStatePointer, static_cast<int32_t>(reg)), remap_8_16(action.reg_type));
+        } else {
+            throw std::logic_error("Unhandled register");
+        }
+    }
+
+    void JitManager::BlockCompiler::emit_register_load(const uint32_t reg_index, const RegType& reg) {
+        const auto reg_type = this->m_register_allocator.get_ir_reg(reg_index);
+        auto& a = this->m_builder;
+
+        if (static_cast<uint32_t>(reg_type) < static_cast<uint32_t>(IRReg::IN)) {
+            if (reg_type == IRReg::VF) {
+                this->emit_flag_resolve();
+            }
+            a.mov(reg, byte_ptr(CoreStatePointer, static_cast<int32_t>(reg_type)));
+        } else if (reg_type == IRReg::IN) {
+            a.mov(remap_8_16(reg), word_ptr(CoreStatePointer, static_cast<int32_t>(reg_type)));
+        } else {
+            throw std::logic_error("Unhandled register");
+        }
+    }
+
     uint32_t JitManager::BlockCompiler::get_spill_offset_for_temp_reg(const uint32_t reg) noexcept {
         if (this->m_spill_mapping.contains(reg)) {
             return this->m_spill_mapping.at(reg);
@@ -877,14 +2181,15 @@ namespace jip {
     void JitManager::BlockCompiler::emit_register_backup(const LinearRegisterAllocator::UsedRegInfo& reg) {
         const auto reg_type = this->m_register_allocator.get_ir_reg(reg.reg_index);
         auto& a = this->m_builder;
-        if (reg_type == IRReg::Invalid) {
+        // Never written since it was loaded, so the CoreState already holds the value
+        if (reg_type == IRReg::Invalid || !reg.dirty) {
             return;
         }
 
         if (static_cast<uint32_t>(reg_type) < static_cast<uint32_t>(IRReg::IN)) {
             a.mov(byte_ptr(CoreStatePointer, static_cast<int32_t>(reg_type)), reg.allocated_register);
         } else if (reg_type == IRReg::IN) {
-            a.mov(dword_ptr(CoreStatePointer, static_cast<int32_t>(reg_type)), remap_8_16(reg.allocated_register));
+            a.mov(word_ptr(CoreStatePointer, static_cast<int32_t>(reg_type)), remap_8_16(reg.allocated_register));
         } else {
             throw std::logic_error("Unhandled register");
         }
@@ -897,14 +2202,33 @@ namespace jip {
             emit_register_backup(reg);
         }
 
-        if (this->m_last_spill_offset != 0) {
-            a.add(StackPointer, this->m_last_spill_offset);
+        // Temps compiled after this exit can still grow the spill area, emit_machine_code fills the size in
+        a.add(StackPointer, 0);
+        this->m_spill_releases.emplace_back(a.cursor()->as<asmjit::InstNode>());
+    }
+
+    // Linking patches every exit in place, so each has to be a whole rel32 jmp inside the block
+    void JitManager::BlockCompiler::validate_block(
+        const void* memory, const size_t code_size, const std::span<const JitBlock::Exit> exits
+    ) {
+        const auto* code = static_cast<const uint8_t*>(memory);
+        constexpr uint8_t JmpRel32 = 0xE9;
+
+        for (const auto& exit : exits) {
+            if (exit.patch_offset == 0 || exit.patch_offset + sizeof(int32_t) > code_size ||
+                code[exit.patch_offset - 1] != JmpRel32) {
+                throw std::logic_error(std::format("Malformed exit to 0x{:x} in a compiled block", exit.target_ip));
+            }
         }
     }
 
     // Clobbers RBP
     void JitManager::BlockCompiler::emit_stack_alignment_check() noexcept {
         auto& a = this->m_builder;
+        if (this->m_manager->m_profile == JitProfile::Release) {
+            return;
+        }
+
         const auto skip = a.new_label();
 
         a.mov(r11, StackPointer);
@@ -916,21 +2240,6 @@ namespace jip {
         a.bind(skip);
     }
 
-    void JitManager::BlockCompiler::emit_clobber_restore() noexcept {
-        auto& a = this->m_builder;
-
-        const auto& clobbered = this->m_register_allocator.clobbered_regs();
-        for (const auto& reg : clobbered | std::ranges::views::reverse) {
-            a.pop(remap_8_64(reg));
-        }
-    }
-    void JitManager::BlockCompiler::add_clobber_restore_point() noexcept {
-        auto& a = this->m_builder;
-
-        auto* const current_node = a.cursor();
-        this->m_restore_locations.emplace_back(current_node);
-    }
-
     void JitManager::BlockCompiler::emit_mov(const RegType& src, const RegType& dst) noexcept {
         auto& a = this->m_builder;
         if (src != dst) {
@@ -1,18 +1,48 @@
 #pragma once
 #include "asmjit/core/jitruntime.h"
+#include "code_cache.hpp"
 #include "instruction_list.hpp"
 #include "ir/ir_manager.hpp"
 #include "jit_block.hpp"
 #include "jpu/core.hpp"
+#include "jpu/interpreter.hpp"
 #include "linear_register_allocator.hpp"
+#include "shared_code.hpp"
 #include "util/memory_stream.hpp"
 #include <asmjit/x86.h>
 
+#include <array>
+#include <atomic>
+#include <bitset>
+#include <condition_variable>
+#include <deque>
+#include <filesystem>
 #include <memory>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <stop_token>
+#include <thread>
 #include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
 
 namespace jip {
     constexpr static auto TotalRegCount = 16 + 2;
+    // One slot per even guest address, the few ROMs which execute from odd addresses go through a slower side table
+    constexpr static size_t DispatchTableSize = MemorySize / 2;
+    // How many times a block runs in the interpreter before it's worth compiling
+    constexpr static uint32_t DefaultHotnessThreshold = 8;
+    // Bytes of host code kept resident before the least recently dispatched blocks start getting evicted
+    constexpr static size_t DefaultCodeCacheBudget = 4 * 1024 * 1024;
+
+    // How much checking and reporting compiled code does on top of running the guest
+    enum class JitProfile : uint8_t {
+        Release,    // Nothing but the guest's own work
+        Checked,    // Runtime asserts in compiled code and the dispatch loop, and every block validated once compiled
+        Diagnostic, // Checked, and every block's disassembly and size printed as it's compiled
+    };
 
     class JitManager {
     public:
@@ -21,17 +51,133 @@ namespace jip {
         JitManager(JitManager&&) = delete;
         JitManager& operator=(const JitManager&) = delete;
         JitManager& operator=(JitManager&&) = delete;
-        ~JitManager() = default;
+        ~JitManager();
+
+        void set_state(CoreState* state) noexcept;
+
+        // 0 queues every block for compilation the first time it's reached
+        void set_hotness_threshold(const uint32_t threshold) noexcept { this->m_hotness_threshold = threshold; }
+
+        // Only checked as blocks get installed, lowering it doesn't evict anything straight away. Blocks of the ahead
+        // of time image don't count towards it
+        void set_code_cache_budget(const size_t bytes) noexcept { this->m_code_cache_budget = bytes; }
+
+        // Checked code can't mix with release code, so this has to come before anything gets compiled, and before
+        // pin_registers, share_code and open_code_cache
+        void set_profile(JitProfile profile);
+
+        // Leaves VF uncomputed whenever nothing in the compiled code producing it reads it, recording the operation in
+        // CoreState::lazy_flag instead. Same restrictions as set_profile
+        void set_lazy_flags(bool enabled) noexcept;
+
+        struct CodeCacheStats {
+            size_t resident_bytes{}; // Of the blocks the budget covers
+            size_t resident_blocks{};
+            uint64_t evictions{};     // Blocks dropped to stay under the budget
+            uint64_t invalidations{}; // Blocks dropped because the guest overwrote their code
+        };
+
+        [[nodiscard]] CodeCacheStats code_cache_stats() const noexcept;
 
-        void set_state(CoreState* state) noexcept { this->m_core_state = state; }
+        // Blocks an earlier run compiled for the same ROM and compiler get installed from the cache file in
+        // `directory` the first time the dispatcher reaches them, without being interpreted or compiled again
+        void open_code_cache(const std::filesystem::path& directory, std::span<const uint8_t> rom) noexcept;
 
-        JitBlock compile_block(uint16_t current_ip, const MemoryStream& block_memory) noexcept;
+        // Writes back every block compiled so far, so the next run of the ROM starts warm
+        void save_code_cache() noexcept;
 
-        [[noreturn]] void execute_loop(uint16_t start_ip, JitBlock start_block) noexcept;
+        // Keeps the ROM's most used V registers in callee saved host registers for as long as the dispatch loop runs
+        // compiled code, so going from one block to the next never loads or stores them. Pinned code can't mix with
+        // unpinned code, so this has to come before anything gets compiled, and before share_code and open_code_cache
+        void pin_registers(std::span<const uint8_t> rom);
+
+        // Uses, and contributes to, the code every other JitManager running the same ROM has compiled. Has to be called
+        // before anything gets compiled
+        void share_code(std::span<const uint8_t> rom);
+
+        // Compiles every block statically reachable from `entry_ip` up front into one contiguous image, with the exits
+        // between them already linked. Targets only known at runtime, BNNN and returns, are still compiled lazily
+        void compile_ahead_of_time(uint16_t entry_ip);
+
+        // Nothing if the JIT can't lower the instruction at `current_ip`, which then has to be interpreted
+        std::optional<JitBlock> compile_block(uint16_t current_ip, std::span<const uint8_t> memory) noexcept;
+
+        // Compiles the likeliest path from `current_ip` as one superblock, see InstructionList::create_trace. `memory`
+        // is the whole of guest memory, the trace can lead anywhere in it
+        std::optional<JitBlock>
+        compile_trace(uint16_t current_ip, std::span<const uint8_t> memory, const SkipProfile& profile) noexcept;
+
+        // Runs from `start_ip` until roughly `budget` guest instructions have executed and returns the ip to resume at.
+        // Compiled blocks are charged whole when entered, so the last one can overshoot the budget by its length. An
+        // idle guest gives up what's left of the budget early, CoreState::wait_event says what it's waiting on
+        uint16_t execute_for(uint16_t start_ip, int32_t budget) noexcept;
+
+        // Makes the block reachable from the dispatcher and links every constant exit that targets it, or that it
+        // owns and targets an already compiled block
+        void register_block(uint16_t ip, JitBlock block) noexcept;
+
+        // Unlinks every exit jumping into the block, so they fall back to the dispatcher, forgets the block and
+        // releases its code
+        void invalidate_block(uint16_t ip) noexcept;
 
     private:
-        [[nodiscard]] static std::unique_ptr<IRManager>
-        emit_ir(const InstructionList& instructions, uint16_t start_ip) noexcept;
+        struct LinkSite {
+            uint16_t source_ip{};
+            uint32_t exit_index{};
+        };
+
+        struct CompileRequest {
+            uint16_t ip{};
+            std::vector<uint8_t> memory{}; // Guest memory as it was when the block got hot
+            SkipProfile profile{};
+        };
+
+        struct CompiledBlock {
+            uint16_t ip{};
+            std::optional<JitBlock> block; // Nothing if the block starts on something the JIT can't lower
+        };
+
+        [[nodiscard]] JitBlock* find_block(uint16_t ip) noexcept;
+        [[nodiscard]] void* dispatch_entry(uint16_t ip) noexcept;
+        [[nodiscard]] bool is_hot(uint16_t ip) noexcept;
+        // Whether a hot block should be compiled here, rather than waited on while another instance compiles it
+        [[nodiscard]] bool should_compile(uint16_t ip) noexcept;
+
+        void queue_compile(uint16_t ip);
+        // Publishes everything the worker has finished, only ever called from the emulation thread between blocks
+        void install_compiled_blocks() noexcept;
+        void compile_worker(const std::stop_token& stop) noexcept;
+
+        // The only way into compiled code. Saves the callee saved registers and loads the pinned ones once, runs blocks
+        // until one needs the dispatcher and undoes both, so blocks themselves don't need a frame
+        void emit_dispatch_loop();
+        // Called by blocks about to load VF while CoreState::lazy_flag is set, computes it and clears the flag
+        void emit_resolve_flag_stub();
+
+        // Relocates and registers the block the code cache holds for `ip`, false if there's none or it's stale
+        bool install_cached_block(uint16_t ip) noexcept;
+        // Registers the shared block for `ip`, false if there's none or it was compiled from different memory
+        bool install_shared_block(uint16_t ip) noexcept;
+        [[nodiscard]] bool in_code_image(const void* code) const noexcept;
+
+        // Invalidates one block to make room, false if there's nothing left to evict
+        bool evict_block() noexcept;
+
+        // Throws away every block built from bytes the last FX33 or FX55 changed
+        void invalidate_written_code() noexcept;
+        [[nodiscard]] bool matches_memory(std::span<const JitBlock::CodeWord> code) const noexcept;
+
+        bool link_exit(const LinkSite& site, const JitBlock& target) noexcept;
+        void unlink_exit(const LinkSite& site) noexcept;
+        static bool patch_exit(void* site, const void* target) noexcept;
+
+        // `memory` is what the instructions were decoded from, the block keeps a copy of their bytes to check against.
+        // Nothing for an empty list
+        std::optional<JitBlock> compile_instructions(
+            const InstructionList& instructions, uint16_t current_ip, std::span<const uint8_t> memory
+        ) noexcept;
+
+        [[nodiscard]] static std::unique_ptr<IRManager> emit_ir(const InstructionList& instructions) noexcept;
 
         class BlockCompiler {
         public:
@@ -39,15 +185,21 @@ namespace jip {
                 JitManager* manager, std::unique_ptr<IRManager> ir, LinearRegisterAllocator register_allocator
             ) noexcept;
 
-            void emit_machine_code(uint16_t ip);
+            // `cost` is how many guest instructions entering the block charges against the cycle budget
+            void emit_machine_code(uint16_t ip, uint32_t cost);
+
+            static JitBlock
+            as_jit_block(const std::unique_ptr<BlockCompiler>& compiler, std::vector<JitBlock::CodeWord> code);
 
-            static JitBlock as_jit_block(const std::unique_ptr<BlockCompiler>& compiler);
+            // The first IR opcode emit_machine_code had no machine code for, the block mustn't be used if there was one
+            [[nodiscard]] std::optional<IROpcode> unhandled_opcode() const noexcept { return this->m_unhandled_opcode; }
 
         private:
             void compile_instruction(const IRInstruction& instruction, uint32_t current_ip);
 
             void compile_add_imm(const IRInstruction& instruction, uint32_t current_ip) noexcept;
             void compile_add(const IRInstruction& instruction, uint32_t current_ip);
+            void compile_add_index_reg(const IRInstruction& instruction, uint32_t current_ip);
             void compile_sub(const IRInstruction& instruction, uint32_t current_ip);
             void compile_sub_inverse(const IRInstruction& instruction, uint32_t current_ip);
             void compile_load_imm(const IRInstruction& instruction, uint32_t current_ip) noexcept;
@@ -70,6 +222,9 @@ namespace jip {
             void compile_jump_ne_imm(const IRInstruction& instruction, uint32_t current_ip) noexcept;
             void compile_jump_eq_reg(const IRInstruction& instruction, uint32_t current_ip) noexcept;
             void compile_jump_ne_reg(const IRInstruction& instruction, uint32_t current_ip) noexcept;
+            void compile_jump_key(const IRInstruction& instruction, uint32_t current_ip) noexcept;
+            void compile_read_timer(const IRInstruction& instruction, uint32_t current_ip) noexcept;
+            void compile_write_timer(const IRInstruction& instruction, uint32_t current_ip) noexcept;
             void compile_jump_jit(const IRInstruction& instruction, uint32_t current_ip) noexcept;
             void compile_read_stack_offset(const IRInstruction& instruction, uint32_t current_ip) noexcept;
             void compile_write_stack_offset(const IRInstruction& instruction, uint32_t current_ip) noexcept;
@@ -80,6 +235,28 @@ namespace jip {
             void compile_div_imm(const IRInstruction& instruction, uint32_t current_ip);
             void compile_mod_imm(const IRInstruction& instruction, uint32_t uint32);
             void compile_read_from_memory(const IRInstruction& instruction, uint32_t uint32);
+            void compile_write_to_memory(const IRInstruction& instruction, uint32_t current_ip);
+            void compile_record_code_write(const IRInstruction& instruction, uint32_t current_ip) noexcept;
+            void compile_exit_if_code_written(const IRInstruction& instruction, uint32_t current_ip) noexcept;
+            void compile_loop_preheader(const IRInstruction& instruction, uint32_t current_ip) noexcept;
+            void compile_loop_back_edge(const IRInstruction& instruction, uint32_t current_ip) noexcept;
+            void compile_idle_wait(const IRInstruction& instruction, uint32_t current_ip) noexcept;
+            void compile_record_lazy_flag(const IRInstruction& instruction, uint32_t current_ip);
+
+            // Computes VF if a lazy flag is pending, has to come before anything loads VF from the state
+            void emit_flag_resolve() noexcept;
+            // Throws away a pending lazy flag once `instruction` has written VF itself
+            void track_lazy_flag(const IRInstruction& instruction);
+
+            // The host register a guest register lives in for the whole of execution, if it's pinned
+            [[nodiscard]] std::optional<RegType> pinned_register(uint32_t reg_index) const noexcept;
+
+            // Leaves `(index + offset) % MemorySize` zero extended in `address`
+            void emit_guest_address(const RegType& index, const RegType& address, uint32_t offset) noexcept;
+
+            void emit_linkable_exit(uint16_t target_ip) noexcept;
+            void emit_dispatch_exit() noexcept;
+            void compile_jump_dynamic(const IRInstruction& instruction, uint32_t current_ip) noexcept;
 
             asmjit::Label& label_for_block(const IRManager::IRBlock& block) noexcept;
             asmjit::Label& label_for_block(uint16_t block_id) noexcept;
@@ -88,11 +265,15 @@ namespace jip {
 
             uint32_t get_spill_offset_for_temp_reg(uint32_t reg) noexcept;
             void emit_register_backup(const LinearRegisterAllocator::UsedRegInfo& reg);
+            // Writes back whatever `action` evicted from the host register it hands out
+            void emit_spill(const LinearRegisterAllocator::RequiredAction& action);
+            void emit_register_load(uint32_t reg_index, const RegType& reg);
 
             void emit_register_saves() noexcept;
             void emit_stack_alignment_check() noexcept;
-            void emit_clobber_restore() noexcept;
-            void add_clobber_restore_point() noexcept;
+
+            // Throws if the finished block isn't safe to link, only done for checked profiles
+            static void validate_block(const void* memory, size_t code_size, std::span<const JitBlock::Exit> exits);
 
             void emit_mov(const RegType& src, const RegType& dst) noexcept;
 
@@ -106,17 +287,63 @@ namespace jip {
             std::unordered_map<uint32_t, uint32_t> m_spill_mapping{};
             std::vector<uint32_t> m_spill_free_offsets{};
             uint32_t m_last_spill_offset{ 0 };
-            std::vector<asmjit::BaseNode*>
-                m_restore_locations{}; // This stores a list of nodes which need to have a register restore bound
+            std::vector<asmjit::InstNode*> m_spill_releases{}; // Every `add rsp` an exit frees the spill area with
+            std::optional<IROpcode> m_unhandled_opcode{};
+            bool m_flag_pending{ false };      // Whether a lazy flag may be pending at this point of the block
+            bool m_flag_record_armed{ false }; // The last instruction recorded a flag for the one being compiled
+            bool m_host_flags_live{ false };   // The host flags hold a result the next FlagRegisterCheck still needs
+            std::vector<std::pair<asmjit::Label, uint16_t>> m_exit_sites{};
+            struct LoopInfo {
+                uint16_t header_ip{};
+                bool native{ false }; // Whether the back edge stays in the block
+            };
+
+            std::unordered_map<uint32_t, LoopInfo> m_loops{}; // Keyed by header block
+            uint16_t m_start_ip{ 0 };
 
             constexpr static auto StackPointer = asmjit::x86::rsp;
             constexpr static auto CoreStatePointer = asmjit::x86::rbp;
         };
 
     private:
-        std::unordered_map<uint16_t, JitBlock> m_blocks{};
+        // Indexed by `ip >> 1`, read directly by the JIT code for exits whose target is only known at runtime. Every
+        // slot without a compiled block holds the miss stub, which just returns the target ip to the dispatcher
+        alignas(64) std::array<void*, DispatchTableSize> m_dispatch_table{};
+        std::array<std::optional<JitBlock>, DispatchTableSize> m_blocks{};
+        std::unordered_map<uint16_t, JitBlock> m_unaligned_blocks{};
+        void* m_miss_stub{ nullptr };
+        void* m_resolve_flag_stub{ nullptr };
+        std::array<uint32_t, DispatchTableSize> m_execution_counts{}; // Interpreted runs of each not yet compiled block
+        std::bitset<MemorySize> m_interpreted_blocks{}; // Blocks starting on an instruction the JIT can't lower
+        std::array<std::vector<uint16_t>, MemorySize> m_code_owners{}; // Blocks translated from each byte of memory
+        size_t m_code_cache_budget{ DefaultCodeCacheBudget };
+        size_t m_resident_code_size{ 0 };
+        std::deque<uint16_t> m_eviction_queue{}; // Oldest registered first, each ip at most once
+        std::bitset<MemorySize> m_eviction_queued{}; // Whether an ip is in the queue, invalidated or not
+        CodeCacheStats m_code_cache_stats{};
+        uint32_t m_hotness_threshold{ DefaultHotnessThreshold };
+        Interpreter m_interpreter{};
+        std::unordered_map<uint16_t, std::vector<LinkSite>> m_linked_exits{};  // Keyed by the block they jump into
+        std::unordered_map<uint16_t, std::vector<LinkSite>> m_pending_exits{}; // Keyed by the ip they wait on
         CoreState* m_core_state{ nullptr };
         asmjit::JitRuntime m_rt{};
-        JitBlock* m_execution_block{ nullptr };
+        std::unique_ptr<CodeCache> m_code_cache{};
+        // Ahead of time images, their blocks share one allocation which is only released along with the runtime
+        std::vector<std::span<const uint8_t>> m_code_images{};
+        std::shared_ptr<SharedCode> m_shared_code{};
+        std::vector<std::pair<uint8_t, asmjit::x86::Gp>> m_pinned_registers{}; // Guest register, and its host register
+        void* m_dispatch_loop{ nullptr };
+        JitProfile m_profile{ JitProfile::Release };
+        bool m_lazy_flags{ false };
+        uint64_t m_code_variant{ 0 }; // Mixed into the ROM hash, so pinned or checked code only gets shared with itself
+        std::unordered_set<uint16_t> m_claimed_blocks{}; // Queued blocks this instance has to publish or abandon
+
+        std::unordered_set<uint16_t> m_queued_blocks{}; // Hot blocks the worker hasn't handed back yet
+        std::mutex m_compile_mutex{};
+        std::condition_variable_any m_compile_ready{};
+        std::deque<CompileRequest> m_compile_queue{};
+        std::vector<CompiledBlock> m_compiled_blocks{};
+        std::atomic<bool> m_has_compiled_blocks{ false };
+        std::jthread m_compile_worker{}; // Last, so it's stopped and joined before anything it touches is destroyed
     };
 } // namespace jip
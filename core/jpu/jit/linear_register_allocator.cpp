@@ -13,6 +13,12 @@ namespace jip {
                  std::ranges::views::transform([](const auto& block) -> const auto& { return block.instructions(); }) |
                  std::views::join | std::views::enumerate) {
 
+            if (instr.code == IROpcode::LoopPreheader) {
+                this->m_loops[instr.immediate].first = access_ip;
+            } else if (instr.code == IROpcode::LoopBackEdge) {
+                this->m_loops[instr.immediate].second = access_ip;
+            }
+
             const auto vx = instr.vx;
             const auto vy = instr.vy;
 
@@ -60,7 +66,7 @@ namespace jip {
                 const UsedRegInfo& reg
             ) {
                 const auto& access_info = this->m_registers[reg.reg_index];
-                if (access_info.end >= ir_ip) {
+                if (access_info.end >= ir_ip || this->is_pinned(reg.reg_index)) {
                     return false;
                 }
 
@@ -89,8 +95,11 @@ namespace jip {
     // to spill
     LinearRegisterAllocator::RequiredAction
     LinearRegisterAllocator::allocate(const uint32_t reg_index, const uint32_t ir_ip) noexcept {
-        for (const auto& used_reg : this->m_used_regs) {
+        const auto written = this->is_written_between(reg_index, ir_ip, ir_ip);
+
+        for (auto& used_reg : this->m_used_regs) {
             if (used_reg.reg_index == reg_index) {
+                used_reg.dirty |= written;
                 return RequiredAction{ .actions = Actions::None, .reg_type = used_reg.allocated_register };
             }
         }
@@ -101,15 +110,15 @@ namespace jip {
         if (!this->m_free_regs.empty()) {
             const auto reg = this->m_free_regs.back();
             this->m_free_regs.pop_back();
-            this->m_used_regs.emplace_back(reg_index, reg);
- this->try_add_clobbered_register(reg);
+            this->m_used_regs.emplace_back(reg_index, reg, written);
 
             return { .actions = action_base, .reg_type = reg };
         }
 
         for (auto& reg : this->m_used_regs) {
-            if (this->next_access_is_write_only(reg.reg_index, ir_ip)) {
+            if (!this->is_pinned(reg.reg_index) && this->next_access_is_write_only(reg.reg_index, ir_ip)) {
                 reg.reg_index = reg_index;
+                reg.dirty = written;
                 return { .actions = action_base, .reg_type = reg.allocated_register };
             }
         }
@@ -121,19 +130,19 @@ namespace jip {
         size_t spilled_register = 0;
         for (const auto& [idx, reg] : this->m_used_regs | std::views::enumerate) {
             const auto dst = this->compute_register_distance(reg.reg_index, ir_ip);
-            if (dst > distance) {
+            if (dst > distance && !this->is_pinned(reg.reg_index)) {
                 distance = dst;
                 spilled_register = idx;
             }
         }
 
-        const auto spilt_index = this->m_used_regs[spilled_register].reg_index;
-        this->m_used_regs[spilled_register].reg_index = reg_index;
+        auto& spilt = this->m_used_regs[spilled_register];
+        const auto spill_info = SpillInfo{ .register_index = spilt.reg_index, .dirty = spilt.dirty };
+        spilt.reg_index = reg_index;
+        spilt.dirty = written;
 
         const auto action = action_base | Actions::Spill;
-        return { .actions = action,
-                 .spill_info = { .register_index = spilt_index },
-                 .reg_type = this->m_used_regs[spilled_register].allocated_register };
+        return { .actions = action, .spill_info = spill_info, .reg_type = spilt.allocated_register };
     }
 
     void LinearRegisterAllocator::allocation_test() noexcept {
@@ -232,6 +241,89 @@ namespace jip {
         std::unreachable();
     }
 
+    std::optional<std::vector<uint32_t>> LinearRegisterAllocator::loop_registers(const uint32_t header_block) const {
+        const auto loop = this->m_loops.find(header_block);
+        if (loop == this->m_loops.end() || loop->second.second <= loop->second.first) {
+            return std::nullopt;
+        }
+
+        const auto [preheader, back_edge] = loop->second;
+        std::vector<uint32_t> registers{};
+
+        const auto in_loop = [&](const AccessInfo& info) { return info.index > preheader && info.index < back_edge; };
+
+        for (const auto& [index, reg] : this->m_register_map) {
+            if (!this->is_cpu_reg(index)) {
+                continue;
+            }
+
+            if (std::ranges::any_of(this->m_registers[index].accesses, in_loop)) {
+                registers.emplace_back(index);
+            }
+        }
+
+        return registers;
+    }
+
+    void LinearRegisterAllocator::release(const uint32_t reg_index) noexcept {
+        const auto it = std::ranges::find(this->m_used_regs, reg_index, &UsedRegInfo::reg_index);
+        if (it == this->m_used_regs.end()) {
+            return;
+        }
+
+        this->m_free_regs.push_back(it->allocated_register);
+        this->m_used_regs.erase(it);
+    }
+
+    bool LinearRegisterAllocator::loop_writes(const uint32_t header_block, const uint32_t reg_index) const noexcept {
+        const auto loop = this->m_loops.find(header_block);
+        if (loop == this->m_loops.end()) {
+            return false;
+        }
+
+        const auto [preheader, back_edge] = loop->second;
+        return this->is_written_between(reg_index, preheader + 1, back_edge);
+    }
+
+    void LinearRegisterAllocator::mark_dirty(const uint32_t reg_index) noexcept {
+        if (const auto it = std::ranges::find(this->m_used_regs, reg_index, &UsedRegInfo::reg_index);
+            it != this->m_used_regs.end()) {
+            it->dirty = true;
+        }
+    }
+
+    bool LinearRegisterAllocator::dies_at(const uint32_t reg_index, const uint32_t ir_ip) const noexcept {
+        return !this->is_pinned(reg_index) && this->m_registers[reg_index].end <= ir_ip;
+    }
+
+    std::optional<LinearRegisterAllocator::UsedRegInfo>
+    LinearRegisterAllocator::coalesce(const uint32_t src, const uint32_t dst, const uint32_t ir_ip) noexcept {
+        if (!this->dies_at(src, ir_ip) || std::ranges::contains(this->m_used_regs, dst, &UsedRegInfo::reg_index)) {
+            return std::nullopt;
+        }
+
+        const auto it = std::ranges::find(this->m_used_regs, src, &UsedRegInfo::reg_index);
+        if (it == this->m_used_regs.end()) {
+            return std::nullopt;
+        }
+
+        const auto previous = *it;
+        it->reg_index = dst;
+        it->dirty = this->is_written_between(dst, ir_ip, ir_ip);
+        return previous;
+    }
+
+    bool LinearRegisterAllocator::is_written_between(
+        const uint32_t reg, const uint32_t from_ip, const uint32_t to_ip
+    ) const noexcept {
+        const auto& accesses = this->m_registers[reg].accesses;
+        const auto first = std::ranges::lower_bound(accesses, from_ip, {}, &AccessInfo::index);
+
+        return std::any_of(first, accesses.end(), [to_ip](const AccessInfo& info) {
+            return info.index <= to_ip && (info.access & AccessType::Write) == AccessType::Write;
+        });
+    }
+
     void LinearRegisterAllocator::add_access_point(
         const uint32_t register_index, const uint32_t relative_ip, const bool read, const bool write
     ) noexcept {
@@ -281,13 +373,7 @@ namespace jip {
         return false;
     }
 
-    void LinearRegisterAllocator::try_add_clobbered_register(const RegType& reg) noexcept {
-        if (std::ranges::contains(this->m_clobbered_registers, reg)) {
-            return;
-        }
-
-        if (std::ranges::contains(this->m_clobber_aware_registers, reg)) {
-            this->m_clobbered_registers.emplace_back(reg);
-        }
+    bool LinearRegisterAllocator::is_pinned(const uint32_t reg) const noexcept {
+        return std::ranges::contains(this->m_pinned, reg);
     }
 } // namespace jip
\ No newline at end of file
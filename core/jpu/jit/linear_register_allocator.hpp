@@ -5,6 +5,7 @@
 
 #include <cstdint>
 #include <limits>
+#include <optional>
 #include <unordered_map>
 #include <vector>
 
@@ -22,6 +23,10 @@ namespace jip {
         struct UsedRegInfo {
             uint32_t reg_index{};
             RegType allocated_register{};
+            // Written since it was allocated, so the CoreState copy is stale. Positions are visited in IR order, which
+            // is the order every forward path through the block takes, so this is exact for every exit but those a
+            // back edge reaches again, see mark_dirty
+            bool dirty{ false };
         };
 
         LinearRegisterAllocator() = default;
@@ -34,12 +39,6 @@ namespace jip {
         void track(const IRManager& manager);
 
         void initialize_free_regs(std::vector<RegType> regs) noexcept { this->m_free_regs = std::move(regs); }
-        void initialize_clobber_aware_registers(std::vector<RegType> regs) noexcept {
-            this->m_clobber_aware_registers = std::move(regs);
-        }
-
-        void add_clobbered(const RegType& reg) noexcept { this->try_add_clobbered_register(reg); }
-
         enum class Actions {
             Spill = 1,
             Load = 2,
@@ -48,6 +47,7 @@ namespace jip {
 
         struct SpillInfo {
             uint32_t register_index;
+            bool dirty; // Whether the spilled register has to be written back at all
         };
 
         struct RequiredAction {
@@ -72,10 +72,35 @@ namespace jip {
 
         [[nodiscard]] const auto& allocated_regs() const noexcept { return this->m_used_regs; }
 
-        [[nodiscard]] const auto& clobbered_regs() const noexcept { return this->m_clobbered_registers; }
-
         [[nodiscard]] RegType get_reg_for_index(uint32_t reg_index) const noexcept;
 
+        // Every guest register accessed between a loop's preheader and its back edge, if the loop has one
+        [[nodiscard]] std::optional<std::vector<uint32_t>> loop_registers(uint32_t header_block) const;
+
+        // Pinned registers are never freed, reused or spilled, which keeps their host register the same on the back
+        // edge as it was on the loop header
+        void pin(uint32_t reg_index) noexcept { this->m_pinned.emplace_back(reg_index); }
+        void unpin_all() noexcept { this->m_pinned.clear(); }
+
+        // Forgets the host register `reg_index` lives in, the caller is responsible for writing the value back
+        void release(uint32_t reg_index) noexcept;
+
+        // Whether anything between the loop's preheader and back edge writes `reg_index`
+        [[nodiscard]] bool loop_writes(uint32_t header_block, uint32_t reg_index) const noexcept;
+
+        // Whether nothing after `ir_ip` accesses `reg_index`, and nothing keeps it in its host register regardless
+        [[nodiscard]] bool dies_at(uint32_t reg_index, uint32_t ir_ip) const noexcept;
+
+        // Renames `src`'s host register to `dst` when `src` dies at `ir_ip` and `dst` isn't in one yet, so copying one
+        // into the other needs no mov. Returns what `src` was, the caller has to write it back if it's dirty
+        std::optional<UsedRegInfo> coalesce(uint32_t src, uint32_t dst, uint32_t ir_ip) noexcept;
+
+        // Exits early in a loop body see the writes of the previous iteration, which linear order hasn't got to yet
+        void mark_dirty(uint32_t reg_index) noexcept;
+
+        // What's left for temporaries has to cover the widest instruction, DXYN holds four at once
+        constexpr static size_t MaxPinnedRegisters = 10;
+
     private:
         void add_access_point(uint32_t register_index, uint32_t relative_ip, bool read, bool write) noexcept;
 
@@ -83,7 +108,9 @@ namespace jip {
 
         [[nodiscard]] bool is_cpu_reg(uint32_t reg) const noexcept;
 
-        void try_add_clobbered_register(const RegType& reg) noexcept;
+        [[nodiscard]] bool is_pinned(uint32_t reg) const noexcept;
+
+        [[nodiscard]] bool is_written_between(uint32_t reg, uint32_t from_ip, uint32_t to_ip) const noexcept;
 
     private:
         struct AccessInfo {
@@ -100,12 +127,13 @@ namespace jip {
 
         std::vector<std::pair<uint32_t, IRReg>> m_register_map{};
 
-        std::vector<RegType> m_clobber_aware_registers{};
-        std::vector<RegType> m_clobbered_registers{};
         std::vector<RegisterLiveRange> m_registers{};
 
         std::vector<RegType> m_free_regs{};
         std::vector<UsedRegInfo> m_used_regs{};
+
+        std::unordered_map<uint32_t, std::pair<uint32_t, uint32_t>> m_loops{}; // Header block to preheader/back edge
+        std::vector<uint32_t> m_pinned{};
     };
 
 } // namespace jip
\ No newline at end of file
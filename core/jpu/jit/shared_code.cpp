@@ -0,0 +1,73 @@
+#include "shared_code.hpp"
+
+#include <asmjit/x86.h>
+#include <unordered_map>
+
+namespace jip {
+    std::shared_ptr<SharedCode> SharedCode::for_rom(const uint64_t rom_hash) {
+        static std::mutex registry_mutex{};
+        static std::unordered_map<uint64_t, std::weak_ptr<SharedCode>> registry{};
+
+        std::scoped_lock lock{ registry_mutex };
+        auto& entry = registry[rom_hash];
+        if (auto shared = entry.lock()) {
+            return shared;
+        }
+
+        auto shared = std::make_shared<SharedCode>();
+        entry = shared;
+        return shared;
+    }
+
+    SharedCode::Claim SharedCode::claim(const uint16_t ip) noexcept {
+        if (this->find(ip) != nullptr) {
+            return Claim::Published;
+        }
+
+        if (ip >= MemorySize || this->m_in_flight[ip].exchange(true, std::memory_order_acq_rel)) {
+            return Claim::InFlight;
+        }
+
+        // Published between the check and the exchange, nothing left to compile
+        if (this->find(ip) != nullptr) {
+            this->m_in_flight[ip].store(false, std::memory_order_release);
+            return Claim::Published;
+        }
+
+        return Claim::Claimed;
+    }
+
+    void SharedCode::abandon(const uint16_t ip) noexcept {
+        if (ip < MemorySize) {
+            this->m_in_flight[ip].store(false, std::memory_order_release);
+        }
+    }
+
+    const SharedCode::Block* SharedCode::publish(const uint16_t ip, const JitBlock& block) {
+        if (ip >= MemorySize) {
+            return nullptr;
+        }
+
+        std::scoped_lock lock{ this->m_publish_mutex };
+        if (this->find(ip) != nullptr) {
+            this->m_in_flight[ip].store(false, std::memory_order_release);
+            return nullptr;
+        }
+
+        asmjit::CodeHolder holder{};
+        holder.init(this->m_rt.environment(), this->m_rt.cpu_features());
+        asmjit::x86::Assembler a{ &holder };
+        a.embed(block.entry(), block.code_size());
+
+        void* entry;
+        if (this->m_rt.add(&entry, &holder) != asmjit::Error::kOk) {
+            this->m_in_flight[ip].store(false, std::memory_order_release);
+            return nullptr;
+        }
+
+        const auto& published = this->m_storage.emplace_back(entry, block.code_size(), block.code());
+        this->m_blocks[ip].store(&published, std::memory_order_release);
+        this->m_in_flight[ip].store(false, std::memory_order_release);
+        return &published;
+    }
+} // namespace jip
@@ -0,0 +1,63 @@
+#pragma once
+#include "asmjit/core/jitruntime.h"
+#include "jit_block.hpp"
+#include "jpu/core.hpp"
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace jip {
+    // Blocks compiled for one ROM, shared by every JitManager running it so each block is only compiled and kept in
+    // memory once. A published block never changes or goes away while anyone still holds the ROM's SharedCode, so
+    // finding one is a single atomic load. Shared code can't be linked, each instance patching exits would redirect
+    // every other instance as well, so its exits always jump through the running instance's dispatch table
+    class SharedCode {
+    public:
+        struct Block {
+            void* entry{ nullptr };
+            size_t code_size{ 0 };
+            std::vector<JitBlock::CodeWord> code{}; // What guest memory has to hold for the block to be usable
+        };
+
+        enum class Claim {
+            Claimed,   // The caller compiles the block and has to either publish or abandon it
+            InFlight,  // Someone else is compiling it, the caller should keep interpreting until it's published
+            Published, // It's been published, if it doesn't match the caller's memory the caller compiles privately
+        };
+
+        SharedCode() = default;
+        ~SharedCode() = default;
+        SharedCode(const SharedCode&) = delete;
+        SharedCode& operator=(const SharedCode&) = delete;
+        SharedCode(SharedCode&&) = delete;
+        SharedCode& operator=(SharedCode&&) = delete;
+
+        // Every caller with the same hash gets the same object, for as long as any of them still holds on to it
+        [[nodiscard]] static std::shared_ptr<SharedCode> for_rom(uint64_t rom_hash);
+
+        [[nodiscard]] const Block* find(const uint16_t ip) const noexcept {
+            return ip < MemorySize ? this->m_blocks[ip].load(std::memory_order_acquire) : nullptr;
+        }
+
+        Claim claim(uint16_t ip) noexcept;
+
+        // Gives a claim up without publishing anything, the next instance the block gets hot in compiles it instead
+        void abandon(uint16_t ip) noexcept;
+
+        // Copies the block into memory every instance can run and ends the claim on it. nullptr if that failed, or if
+        // another instance's block got published first
+        const Block* publish(uint16_t ip, const JitBlock& block);
+
+    private:
+        std::array<std::atomic<const Block*>, MemorySize> m_blocks{};
+        std::array<std::atomic<bool>, MemorySize> m_in_flight{};
+        std::mutex m_publish_mutex{};
+        std::deque<Block> m_storage{}; // Never shrinks, so published pointers stay valid
+        asmjit::JitRuntime m_rt{};
+    };
+} // namespace jip
@@ -2,15 +2,55 @@
 
 namespace jip {
 
-    void JpuCore::load(std::span<const uint8_t> memory) noexcept {
+    void JpuCore::load(std::span<const uint8_t> memory) {
         this->instruction_pointer.set(0x200);
 
         std::ranges::copy(memory, this->memory.begin() + this->instruction_pointer.value());
         this->m_jit.set_state(this);
-        const auto block = this->m_jit.compile_block(
-            this->instruction_pointer.value(),
-            MemoryStream{ std::span{ this->memory }.subspan(this->instruction_pointer.value()) }
-        );
-        this->m_jit.execute_loop(0x200, block);
+
+        if (this->m_jit_profile != JitProfile::Release) {
+            this->m_jit.set_profile(this->m_jit_profile);
+        }
+
+        if (this->m_lazy_flags) {
+            this->m_jit.set_lazy_flags(true);
+        }
+
+        if (this->m_pin_registers) {
+            this->m_jit.pin_registers(memory);
+        }
+
+        if (this->m_share_code) {
+            this->m_jit.share_code(memory);
+        }
+
+        if (!this->m_code_cache_directory.empty()) {
+            this->m_jit.open_code_cache(this->m_code_cache_directory, memory);
+        }
+
+        if (this->m_ahead_of_time) {
+            this->m_jit.compile_ahead_of_time(this->instruction_pointer.value());
+        }
+    }
+
+    void JpuCore::run_for(const int32_t instructions) noexcept {
+        this->instruction_pointer.set(this->m_jit.execute_for(this->instruction_pointer.value(), instructions));
+    }
+
+    void JpuCore::set_key(const uint8_t key, const bool down) noexcept {
+        if (this->keys[key & 0xF] != down) {
+            this->keys[key & 0xF] = down;
+            this->wait_event = WaitEvent::None;
+        }
+    }
+
+    void JpuCore::tick_timers() noexcept {
+        if (this->delay_timer != 0) {
+            this->delay_timer--;
+        }
+
+        if (this->sound_timer != 0) {
+            this->sound_timer--;
+        }
     }
 } // namespace jip
\ No newline at end of file
@@ -3,6 +3,7 @@
 #include "jit/jit_manager.hpp"
 
 #include <cstdint>
+#include <filesystem>
 
 namespace jip {
     class JpuCore : public CoreState {
@@ -14,9 +15,48 @@ namespace jip {
         JpuCore(JpuCore&&) = delete;
         JpuCore& operator=(JpuCore&&) = delete;
 
-        void load(std::span<const uint8_t> memory) noexcept;
+        // Has to be set before load for the ROM's compiled code to be picked up from, and saved to, `directory`
+        void set_code_cache_directory(std::filesystem::path directory) noexcept {
+            this->m_code_cache_directory = std::move(directory);
+        }
+
+        // Release unless set otherwise, see JitProfile
+        void set_jit_profile(const JitProfile profile) noexcept { this->m_jit_profile = profile; }
+
+        // Compiles everything reachable from the entry point on load instead of waiting for blocks to get hot
+        void set_ahead_of_time(const bool enabled) noexcept { this->m_ahead_of_time = enabled; }
+
+        // Keeps the most used guest registers in host registers across blocks, see JitManager::pin_registers
+        void set_pin_registers(const bool enabled) noexcept { this->m_pin_registers = enabled; }
+
+        // Only computes VF when something reads it, see JitManager::set_lazy_flags
+        void set_lazy_flags(const bool enabled) noexcept { this->m_lazy_flags = enabled; }
+
+        // Shares compiled code with every other core running the same ROM in this process
+        void set_share_code(const bool enabled) noexcept { this->m_share_code = enabled; }
+
+        void load(std::span<const uint8_t> memory);
+
+        void save_code_cache() noexcept { this->m_jit.save_code_cache(); }
+
+        // Executes roughly `instructions` guest instructions from where the last call left off
+        void run_for(int32_t instructions) noexcept;
+
+        // Counts the delay and sound timers down, meant to be called at 60Hz
+        void tick_timers() noexcept;
+
+        void set_key(uint8_t key, bool down) noexcept;
+
+        // Running the core before a key changes would only spin in the same idle loop again
+        [[nodiscard]] bool waiting_for_input() const noexcept { return this->wait_event == WaitEvent::Input; }
 
     private:
         JitManager m_jit{};
+        std::filesystem::path m_code_cache_directory{};
+        JitProfile m_jit_profile{ JitProfile::Release };
+        bool m_ahead_of_time{ false };
+        bool m_share_code{ false };
+        bool m_pin_registers{ false };
+        bool m_lazy_flags{ false };
     };
 } // cip
\ No newline at end of file
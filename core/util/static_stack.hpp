@@ -40,6 +40,8 @@ namespace cip {
 
         [[nodiscard]] bool empty() const noexcept { return this->m_size == 0; }
 
+        [[nodiscard]] SizeType size() const noexcept { return this->m_size; }
+
         void clear() noexcept { this->m_size = 0; }
         auto begin() noexcept { return this->m_storage.begin(); }
 
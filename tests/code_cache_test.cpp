@@ -0,0 +1,63 @@
+#include "jpu/jit/code_cache.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <print>
+#include <vector>
+
+// A cache file damaged after it was written must never have its code handed out, while an intact one still is
+int main() {
+    constexpr uint64_t rom_hash = 0x1234;
+    const auto path = std::filesystem::temp_directory_path() / "chipz_code_cache_test.jitcache";
+    std::filesystem::remove(path);
+
+    auto code = std::to_array<uint8_t>({ 0x48, 0x31, 0xC0, 0x48, 0xFF, 0xC0, 0xC3, 0xCC });
+    {
+        jip::CodeCache cache{};
+        cache.open(path, rom_hash);
+        cache.store(jip::JitBlock{ code.data(), code.size(), 0x200, {}, { { 0x200, 0x6001 } } });
+        if (!cache.save()) {
+            std::println("Couldn't write {}", path.string());
+            return 1;
+        }
+    }
+
+    {
+        jip::CodeCache cache{};
+        const auto block = cache.open(path, rom_hash) ? cache.take(0x200) : std::nullopt;
+        if (!block.has_value() || !std::ranges::equal(block->code, code)) {
+            std::println("The intact cache didn't hand back the block it was saved with");
+            return 1;
+        }
+    }
+
+    std::vector<uint8_t> contents{};
+    {
+        std::ifstream file{ path, std::ios::binary };
+        contents.assign(std::istreambuf_iterator<char>{ file }, std::istreambuf_iterator<char>{});
+    }
+
+    const auto stored_code = std::ranges::search(contents, code);
+    if (stored_code.empty()) {
+        std::println("The block's code isn't in the cache file");
+        return 1;
+    }
+    stored_code[1] ^= 0xFF;
+    {
+        std::ofstream file{ path, std::ios::binary | std::ios::trunc };
+        file.write(reinterpret_cast<const char*>(contents.data()), static_cast<std::streamsize>(contents.size()));
+    }
+
+    jip::CodeCache cache{};
+    if (cache.open(path, rom_hash) && cache.take(0x200).has_value()) {
+        std::println("The corrupted block was handed out");
+        return 1;
+    }
+
+    std::filesystem::remove(path);
+    return 0;
+}
@@ -0,0 +1,34 @@
+#include "jpu/jpu_core.hpp"
+
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <print>
+
+// A copy whose target is never read again in the block goes straight to the CoreState instead of through a host
+// register. What the target held before must not be written back over it, and the source has to carry on unchanged
+int main() {
+    constexpr auto rom = std::to_array<uint8_t>({
+        0x60, 0x09, // 200: V0 = 9
+        0xF0, 0x15, // 202: Delay timer = V0
+        0xF1, 0x07, // 204: V1 = delay timer, which the JIT can't know
+        0x62, 0x05, // 206: V2 = 5
+        0x82, 0x10, // 208: V2 = V1, nothing reads V2 after this
+        0x71, 0x01, // 20A: V1 += 1
+        0x12, 0x0C, // 20C: Jump to 20C
+    });
+
+    const auto core = std::make_unique<jip::JpuCore>();
+    core->set_ahead_of_time(true);
+    core->load(rom);
+    core->run_for(1000);
+
+    const auto v1 = core->registers[1].value();
+    const auto v2 = core->registers[2].value();
+    if (v1 != 10 || v2 != 9) {
+        std::println("Expected V1 = 10 and V2 = 9, got V1 = {} and V2 = {}", v1, v2);
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,32 @@
+#include "jpu/jpu_core.hpp"
+
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <print>
+
+// A loop whose header is the first instruction of its block. The back edge has to land on the header itself, not on
+// the entry in front of it, else every iteration reloads the loop's registers from values the body hasn't written back
+int main() {
+    constexpr auto rom = std::to_array<uint8_t>({
+        0x70, 0x01, // 200: V0 += 1, the loop header
+        0x71, 0x02, // 202: V1 += 2
+        0x30, 0x05, // 204: Skip if V0 == 5
+        0x12, 0x00, // 206: Jump to 200
+        0x12, 0x08, // 208: Jump to 208
+    });
+
+    const auto core = std::make_unique<jip::JpuCore>();
+    core->set_ahead_of_time(true);
+    core->load(rom);
+    core->run_for(1000);
+
+    const auto v0 = core->registers[0].value();
+    const auto v1 = core->registers[1].value();
+    if (v0 != 5 || v1 != 10) {
+        std::println("Expected V0 = 5 and V1 = 10, got V0 = {} and V1 = {}", v0, v1);
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,139 @@
+#include "jpu/jit/instruction_list.hpp"
+#include "jpu/jit/ir/ir_manager.hpp"
+#include "jpu/jit/ir/ir_optimizer.hpp"
+#include "jpu/jpu_core.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <print>
+#include <vector>
+
+// Constant folding replaces the FlagRegisterCheck after 8XY4, 8XY5, 8XY6, 8XY7 and 8XYE with the VF it computes
+// itself, which has to be the VF the block compiler's setc, or setc and xor, leaves behind when the operands aren't
+// known. Each operation runs once with both operands known, and once with VY read from the delay timer
+
+struct Result {
+    uint8_t vx{};
+    uint8_t vf{};
+};
+
+// What fold_constants leaves VX and VF loaded with, nothing if it didn't fold both
+static std::optional<Result> folded(const uint8_t x, const uint16_t operation, const uint8_t vx, const uint8_t vy) {
+    const auto y = 2;
+    const auto rom = std::to_array<uint8_t>({
+        static_cast<uint8_t>(0x60 | x), vx, // 200: VX = vx
+        static_cast<uint8_t>(0x60 | y), vy, // 202: VY = vy
+        static_cast<uint8_t>(0x80 | x), static_cast<uint8_t>(y << 4 | operation), // 204: The operation
+        0x12, 0x06, // 206: Jump to 206
+    });
+
+    std::array<uint8_t, jip::MemorySize> memory{};
+    std::ranges::copy(rom, memory.begin() + 0x200);
+
+    jip::InstructionList instructions{};
+    instructions.create_block(memory, 0x200);
+
+    jip::IRManager ir{};
+    ir.init_jump_points(instructions.jump_points());
+    ir.init_loop_headers(instructions.loop_headers());
+    for (const auto& instr : instructions) {
+        ir.emit(instr, instr.address());
+    }
+    ir.close_block(instructions.end_ip());
+
+    jip::IROptimizer optimizer{ ir };
+    optimizer.fold_constants();
+
+    const auto temp_of = [&ir](const jip::IRReg reg) {
+        return std::ranges::find(ir.reg_temps(), reg, &std::pair<uint32_t, jip::IRReg>::second)->first;
+    };
+    const auto x_temp = temp_of(static_cast<jip::IRReg>(x));
+    const auto vf_temp = temp_of(jip::IRReg::VF);
+
+    // The operation's own result and flag are the last loads of either, and nothing may be left computing them
+    std::optional<uint8_t> x_value{};
+    std::optional<uint8_t> vf_value{};
+    for (const auto& instruction : ir.blocks().front().instructions()) {
+        if (instruction.code == jip::IROpcode::FlagRegisterCheck) {
+            return std::nullopt;
+        }
+
+        if (instruction.code == jip::IROpcode::LoadImmediate) {
+            if (instruction.vx->reg == x_temp) {
+                x_value = static_cast<uint8_t>(instruction.immediate);
+            }
+            if (instruction.vx->reg == vf_temp) {
+                vf_value = static_cast<uint8_t>(instruction.immediate);
+            }
+        }
+    }
+
+    if (!x_value.has_value() || !vf_value.has_value()) {
+        return std::nullopt;
+    }
+
+    return Result{ x == 0xF ? *vf_value : *x_value, *vf_value };
+}
+
+// What the compiled code leaves in VX and VF when it can't know VY
+static Result executed(const uint8_t x, const uint16_t operation, const uint8_t vx, const uint8_t vy) {
+    const auto y = 2;
+    const auto rom = std::to_array<uint8_t>({
+        static_cast<uint8_t>(0x60 | y), vy,   // 200: VY = vy
+        static_cast<uint8_t>(0xF0 | y), 0x15, // 202: Delay timer = VY
+        static_cast<uint8_t>(0xF0 | y), 0x07, // 204: VY = delay timer, which the JIT can't know
+        static_cast<uint8_t>(0x60 | x), vx,   // 206: VX = vx
+        static_cast<uint8_t>(0x80 | x), static_cast<uint8_t>(y << 4 | operation), // 208: The operation
+        0x12, 0x0A, // 20A: Jump to 20A
+    });
+
+    const auto core = std::make_unique<jip::JpuCore>();
+    core->set_ahead_of_time(true);
+    core->load(rom);
+    core->run_for(1000);
+
+    return Result{ core->registers[x].value(), core->registers[0xF].value() };
+}
+
+int main() {
+    constexpr auto operations = std::to_array<uint16_t>({ 0x4, 0x5, 0x6, 0x7, 0xE });
+    constexpr auto operands = std::to_array<std::pair<uint8_t, uint8_t>>({
+        { 0x00, 0x00 },
+        { 0x01, 0x02 },
+        { 0x20, 0x20 },
+        { 0x10, 0xF0 },
+        { 0xF0, 0x10 },
+        { 0xFF, 0x01 },
+        { 0x80, 0x7F },
+        { 0x7F, 0x81 },
+    });
+
+    auto failed = false;
+    for (const auto x : { uint8_t{ 1 }, uint8_t{ 0xF } }) {
+        for (const auto operation : operations) {
+            for (const auto [vx, vy] : operands) {
+                const auto fold = folded(x, operation, vx, vy);
+                if (!fold.has_value()) {
+                    std::println("8{:X}2{:X} with {:#x} and {:#x} wasn't folded", x, operation, vx, vy);
+                    failed = true;
+                    continue;
+                }
+
+                const auto run = executed(x, operation, vx, vy);
+                if (fold->vx != run.vx || fold->vf != run.vf) {
+                    std::println(
+                        "8{:X}2{:X} with {:#x} and {:#x} folds to V{:X} = {:#x} and VF = {}, but runs to V{:X} = {:#x} "
+                        "and VF = {}",
+                        x, operation, vx, vy, x, fold->vx, fold->vf, x, run.vx, run.vf
+                    );
+                    failed = true;
+                }
+            }
+        }
+    }
+
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,43 @@
+#include "jpu/jpu_core.hpp"
+
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <print>
+
+// A loop polling the delay timer has to give up its budget while it waits, and still see the timer run out once it's
+// ticked often enough
+int main() {
+    constexpr auto rom = std::to_array<uint8_t>({
+        0x60, 0x05, // 200: V0 = 5
+        0xF0, 0x15, // 202: Delay timer = V0
+        0xF1, 0x07, // 204: V1 = delay timer
+        0x31, 0x00, // 206: Skip if V1 == 0
+        0x12, 0x04, // 208: Jump to 204
+        0x62, 0x2A, // 20A: V2 = 0x2A
+        0x12, 0x0C, // 20C: Jump to 20C
+    });
+
+    const auto core = std::make_unique<jip::JpuCore>();
+    core->set_ahead_of_time(true);
+    core->load(rom);
+
+    auto waited_on_timer = false;
+    for (auto frame = 0; frame < 100 && core->registers[2].value() != 0x2A; frame++) {
+        core->run_for(1000);
+        waited_on_timer |= core->wait_event == jip::WaitEvent::TimerTick;
+        core->tick_timers();
+    }
+
+    if (core->registers[2].value() != 0x2A) {
+        std::println("The loop never saw the delay timer run out");
+        return 1;
+    }
+
+    if (!waited_on_timer) {
+        std::println("The loop never gave up its budget to wait on the timer");
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,41 @@
+#include "jpu/jpu_core.hpp"
+
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <print>
+
+// 8FF4 and 8XF5 read a VF that is still recorded lazily when their block is entered. Resolving it has to happen before
+// the arithmetic, the host flags the arithmetic leaves behind are what its own VF comes from
+int main() {
+    constexpr auto rom = std::to_array<uint8_t>({
+        0x60, 0xF0, // 200: V0 = 0xF0
+        0xF0, 0x15, // 202: Delay timer = V0
+        0xF0, 0x07, // 204: V0 = delay timer, which the JIT can't know
+        0x61, 0x10, // 206: V1 = 0x10
+        0x80, 0x14, // 208: V0 += V1, carries so VF = 1, only read in the next block
+        0x12, 0x0C, // 20A: Jump to 20C
+        0x8F, 0xF4, // 20C: VF += VF, 1 + 1 doesn't carry so VF = 0
+        0x84, 0xF0, // 20E: V4 = VF
+        0x81, 0x05, // 210: V1 -= V0, doesn't borrow so VF = 1, only read in the next block
+        0x12, 0x14, // 212: Jump to 214
+        0x82, 0xF5, // 214: V2 -= VF, 0 - 1 borrows so V2 = 0xFF and VF = 0
+        0x12, 0x16, // 216: Jump to 216
+    });
+
+    const auto core = std::make_unique<jip::JpuCore>();
+    core->set_ahead_of_time(true);
+    core->set_lazy_flags(true);
+    core->load(rom);
+    core->run_for(1000);
+
+    const auto v2 = core->registers[2].value();
+    const auto v4 = core->registers[4].value();
+    const auto vf = core->registers[0xF].value();
+    if (v2 != 0xFF || v4 != 0 || vf != 0) {
+        std::println("Expected V2 = 0xff, V4 = 0 and VF = 0, got V2 = {:#x}, V4 = {} and VF = {}", v2, v4, vf);
+        return 1;
+    }
+
+    return 0;
+}
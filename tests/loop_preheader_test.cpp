@@ -0,0 +1,35 @@
+#include "jpu/jpu_core.hpp"
+
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <print>
+
+// A loop whose header is the instruction a skip guards. Taking the skip jumps past the header into the loop body, so
+// nothing may be set up in front of the header that the body relies on
+int main() {
+    constexpr auto rom = std::to_array<uint8_t>({
+        0x60, 0x00, // 200: V0 = 0
+        0x61, 0x00, // 202: V1 = 0
+        0x30, 0x00, // 204: Skip if V0 == 0, taken the first time round
+        0x71, 0x01, // 206: V1 += 1, the loop header
+        0x70, 0x01, // 208: V0 += 1
+        0x30, 0x0A, // 20A: Skip if V0 == 10
+        0x12, 0x06, // 20C: Jump to 206
+        0x12, 0x0E, // 20E: Jump to 20E
+    });
+
+    const auto core = std::make_unique<jip::JpuCore>();
+    core->set_ahead_of_time(true);
+    core->load(rom);
+    core->run_for(1000);
+
+    const auto v0 = core->registers[0].value();
+    const auto v1 = core->registers[1].value();
+    if (v0 != 10 || v1 != 9) {
+        std::println("Expected V0 = 10 and V1 = 9, got V0 = {} and V1 = {}", v0, v1);
+        return 1;
+    }
+
+    return 0;
+}
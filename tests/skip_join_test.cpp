@@ -0,0 +1,30 @@
+#include "jpu/jpu_core.hpp"
+
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <print>
+
+// A skip over a load joins two paths into its target, one where the load ran and one where it didn't, so nothing may
+// fold the target as if the load always happened
+int main() {
+    constexpr auto rom = std::to_array<uint8_t>({
+        0x30, 0x00, // 200: Skip if V0 == 0, always taken
+        0x61, 0x05, // 202: V1 = 5
+        0x71, 0x01, // 204: V1 += 1
+        0x12, 0x06, // 206: Jump to 206
+    });
+
+    const auto core = std::make_unique<jip::JpuCore>();
+    core->set_ahead_of_time(true);
+    core->load(rom);
+    core->run_for(1000);
+
+    const auto v1 = core->registers[1].value();
+    if (v1 != 1) {
+        std::println("Expected V1 = 1, got V1 = {}", v1);
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,57 @@
+#include "jpu/jit/instruction_list.hpp"
+#include "jpu/jit/ir/ir_manager.hpp"
+#include "jpu/jpu_core.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <print>
+
+// A trace starting on a skip that guards another skip. The IR's skip blocks can't express the pair, so the trace has to
+// end in front of it, and whatever runs it instead still has to take both skips the way the guest does
+int main() {
+    constexpr auto rom = std::to_array<uint8_t>({
+        0x30, 0x00, // 200: Skip if V0 == 0, always taken
+        0x40, 0x00, // 202: Skip if V0 != 0, never reached
+        0x61, 0x05, // 204: V1 = 5
+        0x72, 0x01, // 206: V2 += 1
+        0x12, 0x08, // 208: Jump to 208
+    });
+
+    std::array<uint8_t, jip::MemorySize> memory{};
+    std::ranges::copy(rom, memory.begin() + 0x200);
+
+    jip::InstructionList trace{};
+    trace.create_trace(memory, 0x200, jip::SkipProfile{});
+    const auto guards_skip = [](const jip::Instruction& skip, const jip::Instruction& next) {
+        return skip.is_skip_next() && next.is_skip_next() && next.address() == skip.address() + 2;
+    };
+    const auto nested = std::ranges::adjacent_find(trace, guards_skip);
+    if (nested != trace.end()) {
+        std::println("The trace holds the skip at 0x{:x} together with the skip it guards", nested->address());
+        return 1;
+    }
+
+    jip::IRManager ir{};
+    ir.init_jump_points(trace.jump_points());
+    ir.init_loop_headers(trace.loop_headers());
+    for (const auto& instr : trace) {
+        ir.emit(instr, instr.address());
+    }
+    ir.close_block(trace.end_ip());
+
+    const auto core = std::make_unique<jip::JpuCore>();
+    core->set_ahead_of_time(true);
+    core->load(rom);
+    core->run_for(1000);
+
+    const auto v1 = core->registers[1].value();
+    const auto v2 = core->registers[2].value();
+    if (v1 != 5 || v2 != 1) {
+        std::println("Expected V1 = 5 and V2 = 1, got V1 = {} and V2 = {}", v1, v2);
+        return 1;
+    }
+
+    return 0;
+}